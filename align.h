@@ -0,0 +1,33 @@
+#ifndef ALIGN_H
+#define ALIGN_H
+
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+// Zeroed memory for an object whose type has cache line aligned members. MinGW has no C11 aligned_alloc,
+// so Windows builds use _aligned_malloc, which needs the matching _aligned_free
+static inline void *chip8_aligned_calloc(size_t alignment, size_t size) {
+#if defined(_WIN32)
+    void *memory = _aligned_malloc(size, alignment);
+#else
+    void *memory = aligned_alloc(alignment, size);                                          // size is a multiple of alignment, as sizeof of such a type always is
+#endif
+    if (memory != NULL) {
+        memset(memory, 0, size);
+    }
+    return memory;
+}
+
+// Free memory from chip8_aligned_calloc
+static inline void chip8_aligned_free(void *memory) {
+#if defined(_WIN32)
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+#endif
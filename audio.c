@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+#include "audio.h"
+#include "align.h"
+
+#define BUZZER_FREQUENCY 600    // Square wave played until a ROM loads an XO-Chip pattern
+#define PATTERN_BITS 128
+
+// Allocate a buzzer for a device running at sample_rate
+chip8_audio_t *chip8_audio_create(uint32_t sample_rate) {
+    chip8_audio_t *audio = chip8_aligned_calloc(_Alignof(chip8_audio_t), sizeof *audio);
+    if (audio == NULL) {
+        return NULL;
+    }
+    audio->sample_rate = sample_rate;
+    audio->volume = 3000;
+    audio->rate_pitch = 64;
+    audio->pattern_rate = 4000;
+    return audio;
+}
+
+// Free a buzzer
+void chip8_audio_destroy(chip8_audio_t *audio) {
+    chip8_aligned_free(audio);
+}
+
+// Pattern bits per second for an XO-Chip pitch, 4000 * 2^((pitch - 64) / 48)
+static double pattern_rate(uint8_t pitch) {
+    const double step = 1.0145453349375237;                                                 // 2^(1/48), no libm needed
+    double rate = 4000;
+    for (int i = 64; i < pitch; i++) {
+        rate *= step;
+    }
+    for (int i = pitch; i < 64; i++) {
+        rate /= step;
+    }
+    return rate;
+}
+
+// Render one 60Hz frame of sound
+uint32_t chip8_audio_frame(chip8_audio_t *audio, const chip8_t *chip8) {
+    const double samples = audio->sample_rate / 60.0 + audio->carry;
+    uint32_t count = (uint32_t)samples;
+    audio->carry = samples - count;
+    const uint32_t head = atomic_load_explicit(&audio->head, memory_order_relaxed);
+    const uint32_t free_samples = CHIP8_AUDIO_RING - (head - atomic_load_explicit(&audio->tail, memory_order_acquire));
+    if (count > free_samples) {                                                             // Running ahead of the device, e.g. in turbo mode
+        count = free_samples;
+    }
+    if (chip8->audio_pattern_set && chip8->pitch != audio->rate_pitch) {
+        audio->rate_pitch = chip8->pitch;
+        audio->pattern_rate = pattern_rate(chip8->pitch);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        int16_t sample = 0;
+        if (chip8->sound_timer > 0 && !chip8->audio_pattern_set) {
+            sample = audio->phase < 0.5 ? audio->volume : -audio->volume;
+            audio->phase += (double)BUZZER_FREQUENCY / audio->sample_rate;
+            if (audio->phase >= 1.0) {
+                audio->phase -= 1.0;
+            }
+        }
+        else if (chip8->sound_timer > 0) {
+            const uint32_t bit = (uint32_t)audio->phase;
+            sample = (chip8->audio_pattern[bit / 8] >> (7 - bit % 8)) & 1 ? audio->volume : -audio->volume;
+            audio->phase += audio->pattern_rate / audio->sample_rate;
+            if (audio->phase >= PATTERN_BITS) {
+                audio->phase -= PATTERN_BITS;
+            }
+        }
+        audio->ring[(head + i) & (CHIP8_AUDIO_RING - 1)] = sample;
+    }
+    if (chip8->sound_timer == 0) {
+        audio->phase = 0;                                                                   // The next tone starts at the top of its wave
+    }
+    atomic_store_explicit(&audio->head, head + count, memory_order_release);
+    return count;
+}
+
+// Take count samples for the device
+void chip8_audio_read(chip8_audio_t *audio, int16_t *out, uint32_t count) {
+    const uint32_t tail = atomic_load_explicit(&audio->tail, memory_order_relaxed);
+    const uint32_t queued = atomic_load_explicit(&audio->head, memory_order_acquire) - tail;
+    const uint32_t available = queued < count ? queued : count;
+    for (uint32_t i = 0; i < available; i++) {
+        out[i] = audio->ring[(tail + i) & (CHIP8_AUDIO_RING - 1)];
+    }
+    memset(&out[available], 0, (count - available) * sizeof out[0]);                      // Underrun: silence rather than stale samples
+    atomic_store_explicit(&audio->tail, tail + available, memory_order_release);
+}
@@ -0,0 +1,39 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "chip8.h"
+
+// Samples queued between the emulator and the audio device, a power of two. Bounds the added latency
+#define CHIP8_AUDIO_RING 2048
+
+// Buzzer output of an instance. The emulator renders each 60Hz frame into a single producer, single consumer
+// ring and the audio callback drains it, so the device runs continuously and never needs pausing
+typedef struct {
+    int16_t ring[CHIP8_AUDIO_RING];
+    _Alignas(64) _Atomic uint32_t head;     // Samples rendered, only written by the emulator
+    _Alignas(64) _Atomic uint32_t tail;     // Samples played, only written by the audio callback
+    uint32_t sample_rate;   // Device samples per second
+    double carry;           // Fraction of a sample left over from the last frame
+    double phase;           // Position in the square wave (cycles) or pattern (bits), kept across frames so tones don't click
+    uint8_t rate_pitch;     // Pitch pattern_rate was computed for
+    double pattern_rate;    // Pattern bits per second at rate_pitch
+    int16_t volume;         // Amplitude of the square wave
+} chip8_audio_t;
+
+// Allocate a buzzer for a device running at sample_rate
+chip8_audio_t *chip8_audio_create(uint32_t sample_rate);
+
+// Free a buzzer
+void chip8_audio_destroy(chip8_audio_t *audio);
+
+// Render one 60Hz frame of sound as the sound timer, pattern and pitch of chip8 stand now, called once per frame
+// before chip8_update_timers. Samples that don't fit in the ring are dropped. Returns the number queued
+uint32_t chip8_audio_frame(chip8_audio_t *audio, const chip8_t *chip8);
+
+// Take count samples for the device, called from the audio callback. Plays silence for samples not yet rendered
+void chip8_audio_read(chip8_audio_t *audio, int16_t *out, uint32_t count);
+
+#endif
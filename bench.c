@@ -0,0 +1,206 @@
+#define _POSIX_C_SOURCE 200809L                                                        // clock_gettime
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chip8.h"
+
+// A workload to time, built in or loaded from a file
+typedef struct {
+    const char *name;       // Label in the report
+    const uint8_t *rom;     // ROM image
+    size_t rom_size;        // Size of the ROM image
+} workload_t;
+
+// Tight loop over the 8XY* ALU opcodes and 7XNN, with one rarely taken skip
+const uint8_t alu_rom[] = {
+    0x60, 0x01,     // 200: V0 = 01
+    0x61, 0x07,     // 202: V1 = 07
+    0x62, 0x33,     // 204: V2 = 33
+    0x80, 0x14,     // 206: V0 += V1
+    0x81, 0x25,     // 208: V1 -= V2
+    0x82, 0x01,     // 20A: V2 |= V0
+    0x83, 0x12,     // 20C: V3 &= V1
+    0x84, 0x23,     // 20E: V4 ^= V2
+    0x85, 0x06,     // 210: V5 >>= 1
+    0x86, 0x0E,     // 212: V6 <<= 1
+    0x73, 0x01,     // 214: V3 += 1
+    0x33, 0x00,     // 216: skip if V3 == 0
+    0x12, 0x06,     // 218: jump 206
+    0x12, 0x06,     // 21A: jump 206
+};
+
+// An 8x8 sprite drawn over and over across the screen, wrapping and clipping at the edges
+const uint8_t draw_rom[] = {
+    0xA2, 0x10,     // 200: I = 210
+    0x60, 0x00,     // 202: V0 = 0
+    0x61, 0x00,     // 204: V1 = 0
+    0xD0, 0x18,     // 206: draw 8 rows at V0, V1
+    0x70, 0x05,     // 208: V0 += 5
+    0x71, 0x03,     // 20A: V1 += 3
+    0x12, 0x06,     // 20C: jump 206
+    0x00, 0x00,     // 20E: padding
+    0xFF, 0x81, 0xBD, 0xA5, 0xA5, 0xBD, 0x81, 0xFF,     // 210: sprite
+};
+
+// Nested subroutine calls with a little work in each
+const uint8_t call_rom[] = {
+    0x60, 0x00,     // 200: V0 = 0
+    0x22, 0x08,     // 202: call 208
+    0x12, 0x02,     // 204: jump 202
+    0x00, 0x00,     // 206: padding
+    0x70, 0x01,     // 208: V0 += 1
+    0x22, 0x0E,     // 20A: call 20E
+    0x00, 0xEE,     // 20C: return
+    0x71, 0x01,     // 20E: V1 += 1
+    0x00, 0xEE,     // 210: return
+};
+
+// Clears the font area, then runs off the end of memory through it, so PC carries past 0xFFF until the next jump
+const uint8_t wrap_rom[] = {
+    0x6A, 0x00,     // 200: VA = 0
+    0xA0, 0x00,     // 202: I = 0
+    0xFA, 0x1E,     // 204: I += VA
+    0xF9, 0x55,     // 206: store V0-V9, all 0
+    0x7A, 0x0A,     // 208: VA += 0A
+    0x3A, 0xC8,     // 20A: skip if VA == C8
+    0x12, 0x02,     // 20C: jump 202
+    0x1F, 0xFE,     // 20E: jump FFE, then 0000 no-ops up to 200
+};
+
+// Nanoseconds on the monotonic clock
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Order frame times for the percentiles
+static int compare_ns(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Frame time at percentile p of sorted frame times, in microseconds
+static double percentile_us(const uint64_t *sorted, uint64_t count, double p) {
+    return sorted[(uint64_t)((count - 1) * p)] / 1000.0;
+}
+
+// Run one workload on one engine for instruction_limit instructions and print a line of the report.
+// The hash of the final state goes to state, every engine must end in the same one
+bool run_bench(const workload_t *workload, engine_t engine, uint64_t instruction_limit, uint32_t instructions_per_frame, uint64_t *frame_ns, uint64_t *state) {
+    chip8_t *chip8 = chip8_create();
+    if (chip8 == NULL || !chip8_load_rom(chip8, workload->rom, workload->rom_size)) {
+        chip8_destroy(chip8);
+        return false;
+    }
+    chip8->engine = engine;
+    chip8->display_wait = false;                                                            // Every frame runs its full budget
+    chip8->skip_idle = false;                                                               // Time polling loops as they run
+    chip8->emulation_rate = instructions_per_frame * 60;
+    const uint64_t frame_limit = (instruction_limit + instructions_per_frame - 1) / instructions_per_frame;
+    uint64_t instructions = 0;
+    uint64_t frames = 0;
+    const uint64_t start = now_ns();
+    while (instructions < instruction_limit && frames < frame_limit) {                      // A ROM stuck on FX0A still ends at the frame limit
+        const uint64_t frame_start = now_ns();
+        instructions += chip8_step(chip8, chip8_frame_cycles(chip8));
+        chip8_update_timers(chip8);
+        frame_ns[frames++] = now_ns() - frame_start;
+    }
+    const uint64_t elapsed = now_ns() - start;
+    *state = chip8_state_hash(chip8);
+    chip8_destroy(chip8);
+    qsort(frame_ns, frames, sizeof *frame_ns, compare_ns);
+    printf("%-16.16s %-9s %9.2f %9.3f %9.1f %9.1f %9.1f %9.1f\n", workload->name, chip8_engine_name(engine),
+           elapsed > 0 ? instructions * 1e3 / elapsed : 0.0, instructions > 0 ? (double)elapsed / instructions : 0.0,
+           percentile_us(frame_ns, frames, 0.5), percentile_us(frame_ns, frames, 0.95), percentile_us(frame_ns, frames, 0.99), frame_ns[frames - 1] / 1000.0);
+    return true;
+}
+
+// Read a whole ROM file into a new buffer
+uint8_t *read_rom(const char rom_name[], size_t *rom_size) {
+    FILE *rom = fopen(rom_name, "rb");
+    if (rom == NULL) {
+        printf("Rom file %s is invalid or does not exist\n", rom_name);
+        return NULL;
+    }
+    fseek(rom, 0, SEEK_END);
+    const long size = ftell(rom);
+    rewind(rom);
+    uint8_t *buffer = malloc(size > 0 ? size : 1);
+    if (buffer == NULL || size < 0 || fread(buffer, 1, size, rom) != (size_t)size) {
+        printf("Could not read rom file %s\n", rom_name);
+        free(buffer);
+        fclose(rom);
+        return NULL;
+    }
+    fclose(rom);
+    *rom_size = size;
+    return buffer;
+}
+
+// Main
+int main(int argc, char **argv) {
+    uint64_t instruction_limit = 20000000;
+    uint32_t instructions_per_frame = 10000;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {                         // Options first, then any number of extra ROMs
+        if (strcmp(argv[arg], "--instructions") == 0 && arg + 1 < argc) {
+            instruction_limit = strtoull(argv[++arg], NULL, 0);
+        }
+        else if (strcmp(argv[arg], "--ipf") == 0 && arg + 1 < argc) {
+            instructions_per_frame = strtoul(argv[++arg], NULL, 0);
+        }
+        else {
+            printf("Usage: %s [--instructions N] [--ipf N] [rom...]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (instruction_limit == 0 || instructions_per_frame == 0) {
+        printf("Instructions and instructions per frame must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+    const uint32_t workload_count = 4 + (argc - arg);
+    workload_t *workloads = calloc(workload_count, sizeof *workloads);
+    uint64_t *frame_ns = malloc(((instruction_limit + instructions_per_frame - 1) / instructions_per_frame) * sizeof *frame_ns);
+    if (workloads == NULL || frame_ns == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    workloads[0] = (workload_t) {.name = "alu", .rom = alu_rom, .rom_size = sizeof alu_rom};
+    workloads[1] = (workload_t) {.name = "draw", .rom = draw_rom, .rom_size = sizeof draw_rom};
+    workloads[2] = (workload_t) {.name = "call", .rom = call_rom, .rom_size = sizeof call_rom};
+    workloads[3] = (workload_t) {.name = "wrap", .rom = wrap_rom, .rom_size = sizeof wrap_rom};
+    for (uint32_t i = 4; i < workload_count; i++, arg++) {
+        const char *slash = strrchr(argv[arg], '/');
+        workloads[i].name = slash != NULL ? slash + 1 : argv[arg];
+        workloads[i].rom = read_rom(argv[arg], &workloads[i].rom_size);
+        if (workloads[i].rom == NULL) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("%llu instructions per run, %u per frame\n", (unsigned long long)instruction_limit, instructions_per_frame);
+    printf("%-16s %-9s %9s %9s %9s %9s %9s %9s\n", "rom", "engine", "MIPS", "ns/inst", "p50 us", "p95 us", "p99 us", "max us");
+    bool failed = false;
+    for (uint32_t i = 0; i < workload_count; i++) {
+        uint64_t states[ENGINE_COUNT] = {0};
+        bool ran[ENGINE_COUNT] = {false};
+        for (engine_t engine = 0; engine < ENGINE_COUNT; engine++) {
+            ran[engine] = run_bench(&workloads[i], engine, instruction_limit, instructions_per_frame, frame_ns, &states[engine]);
+            failed |= !ran[engine];
+            if (ran[engine] && ran[0] && states[engine] != states[0]) {                     // Only compare runs that got to the end
+                printf("%s ends in a different state under %s than under %s\n", workloads[i].name, chip8_engine_name(engine), chip8_engine_name(0));
+                failed = true;
+            }
+        }
+    }
+    for (uint32_t i = 4; i < workload_count; i++) {
+        free((uint8_t *)workloads[i].rom);
+    }
+    free(workloads);
+    free(frame_ns);
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -1,54 +1,178 @@
 #include <stdio.h>
-#include <stdint.h>
-#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
-#include "include/SDL2/SDL.h"
+#include "chip8.h"
+#include "trace.h"
+#if CHIP8_PROFILE && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
 
+// Every implemented opcode. Each has a handler op_<name> and an op index OP_<name>
+#define OPCODES(X) \
+    X(00E0) X(00EE) X(00CN) X(00DN) X(00FB) X(00FC) X(00FD) X(00FE) X(00FF) X(1NNN) X(2NNN) X(3XNN) X(4XNN) X(5XY0) X(5XY2) X(5XY3) X(6XNN) X(7XNN) \
+    X(8XY0) X(8XY1) X(8XY2) X(8XY3) X(8XY4) X(8XY5) X(8XY6) X(8XY7) X(8XYE) \
+    X(8XY1_NOVF) X(8XY2_NOVF) X(8XY3_NOVF) X(8XY6_VX) X(8XYE_VX) \
+    X(9XY0) X(ANNN) X(BNNN) X(BXNN) X(CXNN) X(DXYN) X(DXYN_WRAP) X(EX9E) X(EXA1) \
+    X(FX0A) X(FX1E) X(FX07) X(FX15) X(FX18) X(FX29) X(FX33) X(FX55) X(FX65) X(FX55_KEEPI) X(FX65_KEEPI) \
+    X(FX30) X(FX75) X(FX85) X(F000) X(FN01) X(F002) X(FX3A)
+
+enum {
+    OP_DECODE,              // Stale cache entry, decode before executing
+    OP_INVALID,             // Unimplemented opcode, executes as a no-op
+#define OP_INDEX(name) OP_##name,
+    OPCODES(OP_INDEX)
+#undef OP_INDEX
+    OP_COUNT
+};
+
+// Superinstructions the block compiler fuses out of adjacent opcodes
+enum {
+    FUSED_ADD_SE = OP_COUNT,    // 0x7XNN followed by 0x3XKK
+    FUSED_ADD_SNE,              // 0x7XNN followed by 0x4XKK
+    UOP_END,                    // Returns from a block
+    UOP_COUNT
+};
+
+// Counters of a CHIP8_PROFILE build. Time is in timestamp counter ticks on x86, nanoseconds elsewhere
+struct chip8_profile {
+    uint64_t op_count[OP_COUNT];    // Executions of each opcode
+    uint64_t op_time[OP_COUNT];     // Time spent in each opcode
+    uint64_t pc_count[CHIP8_XO_MEMORY_SIZE]; // Executions of the instruction at each address
+    uint64_t pc_time[CHIP8_XO_MEMORY_SIZE];  // Time spent in the instruction at each address
+    uint8_t pc_op[CHIP8_XO_MEMORY_SIZE];     // Opcode last executed at each address
+};
+
+#define BIG_FONT 0x50           // Address of the SuperChip digits, right after the small font
+
+// How each quirk profile behaves, only consulted when decoding. Every quirk selects a handler variant
 typedef struct {
-    SDL_Window *window;
-    SDL_Renderer *renderer;
-    SDL_AudioSpec want, have;
-    SDL_AudioDeviceID device;
-} sdl_t;
+    bool vf_reset;          // 0x8XY1-0x8XY3 clear VF, otherwise the _NOVF variants leave it
+    bool shift_vx;          // 0x8XY6/0x8XYE shift VX in place (_VX variants), otherwise VY into VX
+    bool keep_i;            // 0xFX55/0xFX65 leave I (_KEEPI variants), otherwise it ends past the last register
+    bool jump_vx;           // 0xBXNN adds VX, otherwise 0xBNNN adds V0
+    bool wrap;              // 0xDXYN wraps at the edges (DXYN_WRAP), otherwise clips
+    bool display_wait;      // Default display_wait of the profile
+} quirk_profile_t;
+
+static const quirk_profile_t quirk_profiles[QUIRKS_COUNT] = {
+    [QUIRKS_CHIP8]        = {.vf_reset = true,  .shift_vx = false, .keep_i = false, .jump_vx = false, .wrap = false, .display_wait = true},
+    [QUIRKS_SCHIP_LEGACY] = {.vf_reset = false, .shift_vx = true,  .keep_i = true,  .jump_vx = true,  .wrap = false, .display_wait = true},
+    [QUIRKS_SCHIP_MODERN] = {.vf_reset = false, .shift_vx = true,  .keep_i = true,  .jump_vx = true,  .wrap = false, .display_wait = false},
+    [QUIRKS_XOCHIP]       = {.vf_reset = false, .shift_vx = false, .keep_i = false, .jump_vx = false, .wrap = true,  .display_wait = false},
+};
+
+// Armed breakpoints and watchpoints, bit n % 64 of word n / 64 stands for address n
+struct chip8_breakpoints {
+    uint64_t pc[CHIP8_XO_MEMORY_SIZE / 64];     // Stop before the instruction at these addresses
+    uint64_t read[CHIP8_XO_MEMORY_SIZE / 64];   // Stop before an instruction reads these addresses
+    uint64_t write[CHIP8_XO_MEMORY_SIZE / 64];  // Stop before an instruction writes these addresses
+    uint32_t registers;             // Stop after a change to V[n] for bit n, I for bit 16
+    bool armed;                     // Any of the above is set, chip8_step only pays for checks then
+};
+
+// Machine state chip8_restore_snapshot returns to, the fields chip8_reset and loading a ROM set
+struct chip8_snapshot {
+    uint32_t window_width;
+    uint32_t window_height;
+    bool hires;
+    uint32_t cycle_credit;
+    uint64_t display[64][CHIP8_ROW_WORDS][CHIP8_PLANES];
+    uint8_t planes;
+    uint8_t V[16];
+    uint16_t I;
+    uint16_t PC;
+    uint16_t stack[16];
+    uint8_t depth;          // Entries in use on stack, SP is restored from it
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t audio_pattern[16];
+    bool audio_pattern_set;
+    uint8_t pitch;
+    bool keypad[16];
+    uint8_t wait_key;
+    uint64_t rng;
+    uint8_t state;
+    uint8_t memory[];       // memory_size bytes, only the pages written since are copied back
+};
 
+#define BLOCK_MAX 32            // Longest straight-line run compiled into one block
+#define BLOCK_SPAN 4096         // Addresses blocks are compiled for. Jumps only reach 12 bits, so code above is left to the interpreter
+#define BLOCK_ARENA 8192        // Uops shared by all blocks before the cache is flushed
+
+// One step of a compiled block
 typedef struct {
-    uint16_t opcode;        // Opcode of the instruction
-    uint16_t NNN;           // Lowest 12 bits of the instruction
-    uint8_t NN;             // Lowest 8 bits of the instruction
-    uint8_t N;              // Lowest 4 bits of the instruction
-    uint8_t X;              // Lower 4 bits of the high byte of the instruction
-    uint8_t Y;              // Upper 4 bits of the low byte of the instruction
-} instruction_t;
+    const void *label;          // Code for kind, filled in when threaded dispatch first runs the block
+    instruction_t instruction;  // Operands, for fused uops those of the first opcode
+    uint16_t address;           // Address of the last opcode the uop covers
+    uint8_t kind;               // OP_<name> index or one of the FUSED_ kinds
+    uint8_t compare;            // Immediate of the fused skip
+} uop_t;
 
 typedef struct {
-    uint32_t window_width;  // Pixel width of the origin chip-8
-    uint32_t window_height; // Pixel height of the original chip-8
-    uint32_t window_scale;  // Window size scaling
-    uint32_t emulation_rate; // number of instructions to read per second
-    uint8_t memory[4096];   // Chip-8 ram of 4KB (4096 bytes)
-    bool display[64 * 32];  // Display size 64 * 32
-    uint8_t V[16];          // Registers
-    uint16_t I;             // Index Pointer
-    uint16_t PC;            // Program Counter
-    uint16_t stack[16];     // Stack
-    uint16_t *SP;           // Stack Pointer
-    uint8_t delay_timer;    // Delay Timer
-    uint8_t sound_timer;    // Sound Timer
-    bool keypad[16];        // Keypad for button input
-    uint8_t state;          // State = Active, Paused, Quit
-    bool debug_state;       // Determines whether debug information is shown
-    uint8_t mode;           // Swaps between the original chip-8, superchip, and xo-chip
-    bool draw;              // Determines whether the display will refresh or not
-} chip8_t;
-
-// Initialize chip-8 configuration to default values
-bool initialize_chip8(chip8_t *chip8, const char rom_name[]) {
+    uint16_t first;             // Index of the first uop in the arena
+    uint8_t length;             // Opcodes covered, 0 if the address has not been compiled
+    uint8_t uops;               // Uops in the block, 0 if the address must be interpreted
+    bool jumped;                // Follows a 1NNN, which drops whatever PC carried past the end of memory
+} block_t;
+
+struct block_cache {
+    block_t blocks[BLOCK_SPAN]; // Block starting at each address of memory
+    uop_t arena[BLOCK_ARENA];   // Storage for the uops of every block
+    uint16_t used;              // Arena entries in use
+    uint8_t code_map[BLOCK_SPAN / 8]; // Addresses covered by a compiled block
+    uint64_t smc_pages;         // 64 byte pages written while holding compiled code, never compiled again
+};
+
+// Allocate an instance reset to power-on state with no ROM loaded
+chip8_t *chip8_create(void) {
+    return chip8_create_with_memory(CHIP8_MEMORY_SIZE);
+}
+
+// Allocate an instance with memory_size bytes of memory, the cache and memory in the same block as the registers
+chip8_t *chip8_create_with_memory(uint32_t memory_size) {
+    if (memory_size < CHIP8_MEMORY_SIZE || memory_size > CHIP8_XO_MEMORY_SIZE || (memory_size & (memory_size - 1)) != 0) {
+        printf("Memory size must be a power of two from %u to %u bytes\n", CHIP8_MEMORY_SIZE, CHIP8_XO_MEMORY_SIZE);
+        return NULL;
+    }
+    chip8_t *chip8 = calloc(1, sizeof(chip8_t) + memory_size * (sizeof(decoded_t) + 1));
+    if (chip8 == NULL) {
+        return NULL;
+    }
+    chip8->memory_size = memory_size;
+    chip8->memory = (uint8_t *)&chip8->cache[memory_size];
+    chip8->emulation_rate = 600;
+    chip8->display_wait = true;
+    chip8->debug_state = 0;
+    chip8->mode = MODE_CHIP8;
+    chip8->quirks = QUIRKS_CHIP8;
+    chip8->engine = CHIP8_ENGINE;
+    chip8->skip_idle = true;
+    chip8->seed = 1;                                                                        // Same sequence every run unless the caller picks a seed
+    chip8_reset(chip8);
+    return chip8;
+}
+
+// Free an instance created with chip8_create
+void chip8_destroy(chip8_t *chip8) {
+    if (chip8 != NULL) {
+        chip8_trace_stop(chip8);
+        free(chip8->blocks);
+        free(chip8->profile);
+        free(chip8->breakpoints);
+        free(chip8->snapshot);
+    }
+    free(chip8);
+}
+
+// Reset the machine to power-on state, keeping the configuration set up by chip8_create
+void chip8_reset(chip8_t *chip8) {
+    chip8->cycle_credit = 0;
     chip8->window_width = 64;
     chip8->window_height = 32;
-    chip8->window_scale = 12;
-    chip8->emulation_rate = 600;
-    memset(chip8->memory, 0, sizeof(chip8->memory));
+    chip8->hires = false;
+    chip8->planes = 1;
+    memset(chip8->memory, 0, chip8->memory_size);
     memset(chip8->display, 0, sizeof(chip8->display));
     memset(chip8->V, 0, sizeof(chip8->V));
     memset(chip8->stack, 0, sizeof(chip8->stack));
@@ -58,9 +182,20 @@ bool initialize_chip8(chip8_t *chip8, const char rom_name[]) {
     chip8->SP = &chip8->stack[0];
     chip8->delay_timer = 0;
     chip8->sound_timer = 0;
+    memset(chip8->audio_pattern, 0, sizeof chip8->audio_pattern);
+    chip8->audio_pattern_set = false;
+    chip8->pitch = 64;
     chip8->state = 1;
-    chip8->debug_state = 0;
-    chip8->mode = 0;
+    chip8->wait_key = 0xFF;
+    chip8->break_reason = CHIP8_BREAK_NONE;
+    chip8->halted = false;
+    chip8->blocked = false;
+    chip8_seed(chip8, chip8->seed);
+    chip8->dirty_rows = ~0ull;                                                              // The cleared display has not been shown yet
+    chip8_invalidate_cache(chip8);
+    if (chip8->blocks != NULL) {
+        chip8->blocks->smc_pages = 0;
+    }
     const uint8_t font[80] = {
         0xF0, 0x90, 0x90, 0x90, 0xF0,   // 0
         0x20, 0x60, 0x20, 0x20, 0x70,   // 1
@@ -80,431 +215,1956 @@ bool initialize_chip8(chip8_t *chip8, const char rom_name[]) {
         0xF0, 0x80, 0xF0, 0x80, 0x80    // F
     };
     memcpy(chip8->memory, font, sizeof(font));
+    const uint8_t big_font[100] = {     // SuperChip 8x10 digits for 0xFX30
+        0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C,     // 0
+        0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C,     // 1
+        0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF,     // 2
+        0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C,     // 3
+        0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06,     // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C,     // 5
+        0x3E, 0x7C, 0xE0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C,     // 6
+        0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60,     // 7
+        0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C,     // 8
+        0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C      // 9
+    };
+    memcpy(&chip8->memory[BIG_FONT], big_font, sizeof(big_font));
+}
+
+// Set the seed 0xCXNN restarts from and restart its sequence
+void chip8_seed(chip8_t *chip8, uint64_t seed) {
+    uint64_t z = seed + 0x9E3779B97F4A7C15ull;                                              // splitmix64, so nearby seeds start far apart
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    chip8->seed = seed;
+    chip8->rng = z != 0 ? z : 1;                                                            // xorshift never leaves 0
+}
+
+// Next byte of the 0xCXNN generator, xorshift64*
+static inline uint8_t next_random(chip8_t *chip8) {
+    chip8->rng ^= chip8->rng >> 12;
+    chip8->rng ^= chip8->rng << 25;
+    chip8->rng ^= chip8->rng >> 27;
+    return (chip8->rng * 0x2545F4914F6CDD1Dull) >> 56;
+}
+
+// Reset and copy a ROM image to 0x200
+bool chip8_load_rom(chip8_t *chip8, const uint8_t *rom, size_t rom_size) {
+    const size_t max_size = chip8->memory_size - 0x200;
+    if (rom_size > max_size) {
+        printf("File too large to open. Maximum allowable file size: %zu bytes. Current file size: %zu bytes\n", max_size, rom_size);
+        return false;
+    }
+    chip8_reset(chip8);
+    memcpy(&chip8->memory[0x200], rom, rom_size);
+    return true;
+}
+
+// Reset and load a ROM from disk
+bool chip8_load_rom_file(chip8_t *chip8, const char rom_name[]) {
+    uint8_t *buffer = malloc(chip8->memory_size);
     // Read rom file
     FILE *rom = fopen(rom_name, "rb");
-    fseek(rom, 0, SEEK_END);
-    const size_t rom_size = ftell(rom);
-    const size_t max_size = sizeof chip8->memory - 0x200;
-    if (rom_size > max_size) {
-        printf("File too large to open. Maximum allowable file size: %lu bytes. Current file size: %lu bytes\n", max_size, rom_size);
+    if (rom == NULL || buffer == NULL) {
+        printf("Could not open rom: %s\n", rom_name);
+        if (rom != NULL) {
+            fclose(rom);
+        }
+        free(buffer);
         return false;
     }
+    fseek(rom, 0, SEEK_END);
+    const long rom_size = ftell(rom);
     rewind(rom);
-    fread(&chip8->memory[0x200], rom_size, 1, rom);
+    const size_t read_size = rom_size < 0 ? 0 : (size_t)rom_size < chip8->memory_size ? (size_t)rom_size : chip8->memory_size;
+    const bool read = rom_size >= 0 && fread(buffer, 1, read_size, rom) == read_size;
     fclose(rom);
-    return true;
+    if (!read) {
+        printf("Could not read rom: %s\n", rom_name);
+    }
+    const bool loaded = read && chip8_load_rom(chip8, buffer, rom_size);                   // Oversized roms are rejected before the buffer is read
+    free(buffer);
+    return loaded;
 }
 
-// Audio Control
-void audio_callback(void *userdata, uint8_t *stream, int len) {
-    int16_t *audio_data = (int16_t *)stream;
-    static uint32_t sampleindex = 0;
-    const uint32_t frequency = 600;
-    const uint32_t samplerate = 44100;
-    const int volume = 3000;
-    for (int i = 0; i < len / 2; i++) {
-        audio_data[i] = ((sampleindex++ / ((samplerate / frequency) / 2)) % 2) ? volume : -volume;
+// Decode the instruction at address into its cache entry
+static void decode_instruction(chip8_t *chip8, decoded_t *entry, uint16_t address);
+
+// Invalidate the cache entries that overlap a byte of memory
+static inline void invalidate_address(chip8_t *chip8, uint16_t address);
+
+// Throw away every compiled block
+static void flush_blocks(struct block_cache *cache);
+
+// Remember the machine for chip8_restore_snapshot
+bool chip8_take_snapshot(chip8_t *chip8) {
+    if (chip8->snapshot == NULL && (chip8->snapshot = malloc(sizeof(struct chip8_snapshot) + chip8->memory_size)) == NULL) {
+        return false;
     }
+    struct chip8_snapshot *snapshot = chip8->snapshot;
+    snapshot->window_width = chip8->window_width;
+    snapshot->window_height = chip8->window_height;
+    snapshot->hires = chip8->hires;
+    snapshot->cycle_credit = chip8->cycle_credit;
+    memcpy(snapshot->display, chip8->display, sizeof snapshot->display);
+    snapshot->planes = chip8->planes;
+    memcpy(snapshot->V, chip8->V, sizeof snapshot->V);
+    snapshot->I = chip8->I;
+    snapshot->PC = chip8->PC;
+    memcpy(snapshot->stack, chip8->stack, sizeof snapshot->stack);
+    snapshot->depth = chip8->SP - chip8->stack;
+    snapshot->delay_timer = chip8->delay_timer;
+    snapshot->sound_timer = chip8->sound_timer;
+    memcpy(snapshot->audio_pattern, chip8->audio_pattern, sizeof snapshot->audio_pattern);
+    snapshot->audio_pattern_set = chip8->audio_pattern_set;
+    snapshot->pitch = chip8->pitch;
+    memcpy(snapshot->keypad, chip8->keypad, sizeof snapshot->keypad);
+    snapshot->wait_key = chip8->wait_key;
+    snapshot->rng = chip8->rng;
+    snapshot->state = chip8->state;
+    memcpy(snapshot->memory, chip8->memory, chip8->memory_size);
+    memset(chip8->written_pages, 0, sizeof chip8->written_pages);
+    return true;
 }
 
-// Initialize SDL2 dependencies
-void initialize_sdl(sdl_t *sdl, chip8_t *chip8) {
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER) != 0) {
-        printf("SDL Initialization Error: %s\n", SDL_GetError());
+// Return to the snapshot, copying back only the pages of memory written since
+bool chip8_restore_snapshot(chip8_t *chip8) {
+    const struct chip8_snapshot *snapshot = chip8->snapshot;
+    if (snapshot == NULL) {
+        return false;
+    }
+    if (snapshot->hires != chip8->hires) {                                                  // The frontend redraws everything on a resolution change
+        chip8->dirty_rows = ~0ull;
+    }
+    chip8->window_width = snapshot->window_width;
+    chip8->window_height = snapshot->window_height;
+    chip8->hires = snapshot->hires;
+    chip8->cycle_credit = snapshot->cycle_credit;
+    for (uint32_t y = 0; y < 64; y++) {
+        if (memcmp(chip8->display[y], snapshot->display[y], sizeof snapshot->display[y]) != 0) {
+            memcpy(chip8->display[y], snapshot->display[y], sizeof snapshot->display[y]);
+            chip8->dirty_rows |= 1ull << y;
+        }
+    }
+    chip8->planes = snapshot->planes;
+    memcpy(chip8->V, snapshot->V, sizeof chip8->V);
+    chip8->I = snapshot->I;
+    chip8->PC = snapshot->PC;
+    memcpy(chip8->stack, snapshot->stack, sizeof chip8->stack);
+    chip8->SP = &chip8->stack[snapshot->depth];
+    chip8->delay_timer = snapshot->delay_timer;
+    chip8->sound_timer = snapshot->sound_timer;
+    memcpy(chip8->audio_pattern, snapshot->audio_pattern, sizeof chip8->audio_pattern);
+    chip8->audio_pattern_set = snapshot->audio_pattern_set;
+    chip8->pitch = snapshot->pitch;
+    memcpy(chip8->keypad, snapshot->keypad, sizeof chip8->keypad);
+    chip8->wait_key = snapshot->wait_key;
+    chip8->rng = snapshot->rng;
+    chip8->state = snapshot->state;
+    chip8->break_reason = CHIP8_BREAK_NONE;
+    chip8->halted = false;
+    chip8->blocked = false;
+    chip8->idle_reject = UINT32_MAX;
+    bool flush = false;
+    const uint32_t pages = chip8->memory_size / 64;
+    for (uint32_t word = 0; word < (pages + 63) / 64; word++) {
+        for (uint32_t bit = 0; bit < 64 && chip8->written_pages[word] >> bit != 0; bit++) { // Stops after the highest written page of the word
+            const uint32_t page = (word * 64 + bit) * 64;
+            if ((chip8->written_pages[word] >> bit & 1) == 0 || page >= chip8->memory_size || memcmp(&chip8->memory[page], &snapshot->memory[page], 64) == 0) {
+                continue;
+            }
+            memcpy(&chip8->memory[page], &snapshot->memory[page], 64);
+            for (uint32_t address = page; address < page + 64; address++) {
+                invalidate_address(chip8, address);
+                flush |= chip8->blocks != NULL && address < BLOCK_SPAN && chip8->blocks->code_map[address >> 3] & (1 << (address & 7));
+            }
+        }
+    }
+    if (flush) {
+        flush_blocks(chip8->blocks);
     }
-    sdl->window = SDL_CreateWindow("Chipette", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, chip8->window_width * chip8->window_scale, chip8->window_height * chip8->window_scale, 0);
-    sdl->renderer = SDL_CreateRenderer(sdl->window, -1, SDL_RENDERER_ACCELERATED);
-    sdl->want = (SDL_AudioSpec) {.freq = 44100, .format = AUDIO_S16LSB, .channels = 1, .samples = 512, .callback = audio_callback};
-    sdl->device = SDL_OpenAudioDevice(NULL, 0, &sdl->want, &sdl->have, 0);
+    memset(chip8->written_pages, 0, sizeof chip8->written_pages);
+    return true;
 }
 
-// Update timers at a rate of 60Hz
-void update_timers(sdl_t *sdl, chip8_t *chip8) {
-    if (chip8->delay_timer > 0) {
-        chip8->delay_timer--;
+// Read a byte of memory, addresses past the end wrap around
+static inline uint8_t read_memory(const chip8_t *chip8, uint16_t address) {
+    return chip8->memory[address & (chip8->memory_size - 1)];
+}
+
+// Write a byte to memory, dropping any decoded instruction or compiled block that covers it
+static inline void write_memory(chip8_t *chip8, uint16_t address, uint8_t value) {
+    address &= chip8->memory_size - 1;
+    chip8->memory[address] = value;
+    chip8->written_pages[address >> 12] |= 1ull << ((address >> 6) & 63);
+    invalidate_address(chip8, address);
+    if (chip8->blocks != NULL && address < BLOCK_SPAN && chip8->blocks->code_map[address >> 3] & (1 << (address & 7))) {
+        chip8->blocks->smc_pages |= 1ull << (address >> 6);                                 // Self-modifying code, leave this page to the interpreter
+        flush_blocks(chip8->blocks);
     }
-    if (chip8->sound_timer > 0) {
-        chip8->sound_timer--;
-        SDL_PauseAudioDevice(sdl->device, 0);
+}
+
+// Cache miss: decode the instruction that was just fetched, then execute it
+static void op_decode(chip8_t *chip8, const instruction_t *instruction) {
+    (void)instruction;
+    decoded_t *entry = &chip8->cache[(chip8->PC - 2) & (chip8->memory_size - 1)];
+    decode_instruction(chip8, entry, chip8->PC - 2);
+    entry->handler(chip8, &entry->instruction);
+}
+
+static void op_invalid(chip8_t *chip8, const instruction_t *instruction) {
+    if (chip8->debug_state == 1) {
+        printf("Unimplemented/Invalid opcode: 0x%04X\n", instruction->opcode);
     }
-    else {
-        SDL_PauseAudioDevice(sdl->device, 1);
+}
+
+// All ones if 0xFN01 selected plane, zero if not
+static inline uint64_t selected(const chip8_t *chip8, uint8_t plane) {
+    return -(uint64_t)((chip8->planes >> plane) & 1);
+}
+
+static void op_00E0(chip8_t *chip8, const instruction_t *instruction) {                 // 0x00E0
+    (void)instruction;
+    const uint64_t keep[CHIP8_PLANES] = {~selected(chip8, 0), ~selected(chip8, 1)};
+    for (uint32_t y = 0; y < 64; y++) {
+        for (uint32_t word = 0; word < CHIP8_ROW_WORDS; word++) {
+            chip8->display[y][word][0] &= keep[0];
+            chip8->display[y][word][1] &= keep[1];
+        }
     }
+    chip8->dirty_rows = ~0ull;
 }
 
-// Clear the screen
-void clear_screen(sdl_t *sdl) {
-    SDL_SetRenderDrawColor(sdl->renderer, 20, 20, 20, 255);
-    SDL_RenderClear(sdl->renderer);
+// Rows of the current resolution as a dirty_rows mask
+static inline uint64_t all_rows(const chip8_t *chip8) {
+    return chip8->window_height == 64 ? ~0ull : (1ull << chip8->window_height) - 1;
 }
 
-// Update the screen
-void update_screen(sdl_t *sdl, chip8_t *chip8) {
-    SDL_Rect pixel = {.x = 0, .y = 0, .w = chip8->window_scale, .h = chip8->window_scale};
-    // Draw the pixels on the display
-    for (uint32_t i = 0; i < chip8->window_width * 32; i++) {
-        pixel.x = (i % chip8->window_width) * pixel.w;
-        pixel.y = (i / chip8->window_width) * pixel.h;
-        if (chip8->display[i]) {
-            SDL_SetRenderDrawColor(sdl->renderer, 200, 200, 200, 255);
-            SDL_RenderFillRect(sdl->renderer, &pixel);
+// Scroll the selected planes down by rows, or up if rows is negative, filling in blank rows
+static void scroll_vertical(chip8_t *chip8, int32_t rows) {
+    const int32_t height = chip8->window_height;
+    for (uint8_t plane = 0; plane < CHIP8_PLANES; plane++) {
+        if (!selected(chip8, plane)) {
+            continue;
         }
-        else {
-            SDL_SetRenderDrawColor(sdl->renderer, 20, 20, 20, 255);
-            SDL_RenderFillRect(sdl->renderer, &pixel);
+        for (int32_t i = 0; i < height; i++) {
+            const int32_t y = rows > 0 ? height - 1 - i : i;                                // Walk away from the rows still to be read
+            const int32_t source = y - rows;
+            for (uint32_t word = 0; word < CHIP8_ROW_WORDS; word++) {
+                chip8->display[y][word][plane] = source >= 0 && source < height ? chip8->display[source][word][plane] : 0;
+            }
         }
     }
-    SDL_RenderPresent(sdl->renderer);
+    chip8->dirty_rows |= all_rows(chip8);
 }
 
-// Quit everything
-void quit_all(sdl_t *sdl) {
-    SDL_DestroyRenderer(sdl->renderer);
-    SDL_DestroyWindow(sdl->window);
-    SDL_CloseAudioDevice(sdl->device);
-    SDL_Quit();
+static void op_00CN(chip8_t *chip8, const instruction_t *instruction) {                 // 0x00CN
+    scroll_vertical(chip8, instruction->N);
 }
 
-// Handle keyboard input
-void handle_input(chip8_t *chip8, const char rom_name[]) {
-    const uint8_t key_map[16] = {
-        SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3,     // 0, 1, 2, 3
-        SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A,     // 4, 5, 6, 7
-        SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C,     // 8, 9, A, B
-        SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V      // C, D, E, F
-    };
-    SDL_Event event;
-    while (SDL_PollEvent(&event)) {
-        switch (event.type) {
-            case SDL_QUIT:  // End program when exiting
-                chip8->state = 0;
-                break;
-            case SDL_KEYDOWN:
-                for (int i = 0; i < 16; i++) {
-                    if (event.key.keysym.scancode == key_map[i]) {
-                        chip8->keypad[i] = true;
-                        break;
-                    }
-                    else if (event.key.keysym.scancode == SDL_SCANCODE_ESCAPE) {            // Allow exiting with ESC key
-                        chip8->state = 0;
-                        break;
-                    }
-                    else if (event.key.keysym.scancode == SDL_SCANCODE_P) {                 // P to Pause/Unpause
-                        if (chip8->state == 1) {
-                            chip8->state = 2;
-                            printf("PAUSED\n");
-                        }
-                        else if (chip8->state == 2) {
-                            chip8->state = 1;
-                            printf("UNPAUSED\n");
-                        }
-                        break;
-                    }
-                    else if (event.key.keysym.scancode == SDL_SCANCODE_T) {                 // Restart rom
-                        initialize_chip8(chip8, rom_name);
-                        break;
-                    }
-                    else if (event.key.keysym.scancode == SDL_SCANCODE_B) {                 // Enable/Disable debug information
-                        if (chip8->debug_state == 0) {
-                            chip8->debug_state = 1;
-                            chip8->emulation_rate = 1;
-                            printf("DEBUG MODE ACTIVATED\n");
-                        }
-                        else if (chip8->debug_state == 1) {
-                            chip8->debug_state = 0;
-                            chip8->emulation_rate = 600;
-                            printf("DEBUG MODE DEACTIVATED\n");
-                        }
-                        break;
-                    }
-                    else if (event.key.keysym.scancode == SDL_SCANCODE_TAB) {               // Swap between Chip-8, Superchip, and XO-Chip modes
-                        uint8_t chip_mode = chip8->mode;
-                        if (chip_mode == 0) {
-                            chip8->mode = 1;
-                            printf("CHIP MODE: SUPERCHIP\n");
-                        }
-                        else if (chip_mode == 1) {
-                            chip8->mode = 2;
-                            printf("CHIP MODE: XO-CHIP\n");
-                        }
-                        else if (chip_mode == 2) {
-                            chip8->mode = 0;
-                            printf("CHIP MODE: CHIP-8\n");
-                        }
-                        break;
-                    }
-                }
-                break;
-            case SDL_KEYUP:
-                for (int i = 0; i < 16; i++) {
-                    if (event.key.keysym.scancode == key_map[i]) {
-                        chip8->keypad[i] = false;
-                        break;
-                    }
-                }
-                break;
+static void op_00DN(chip8_t *chip8, const instruction_t *instruction) {                 // 0x00DN
+    scroll_vertical(chip8, -(int32_t)instruction->N);
+}
+
+static void op_00FB(chip8_t *chip8, const instruction_t *instruction) {                 // 0x00FB
+    (void)instruction;
+    const uint32_t words = chip8->window_width / 64;
+    for (uint8_t plane = 0; plane < CHIP8_PLANES; plane++) {
+        if (!selected(chip8, plane)) {
+            continue;
+        }
+        for (uint32_t y = 0; y < chip8->window_height; y++) {                               // Scroll right 4 pixels, one word shift per word
+            uint64_t (*row)[CHIP8_PLANES] = chip8->display[y];
+            for (uint32_t i = words - 1; i > 0; i--) {
+                row[i][plane] = row[i][plane] >> 4 | row[i - 1][plane] << 60;
+            }
+            row[0][plane] >>= 4;
         }
     }
+    chip8->dirty_rows |= all_rows(chip8);
 }
 
-// Emulate one instruction
-void emulate_instruction(chip8_t *chip8, instruction_t *instruction) {
-    bool carry;
-    instruction->opcode = (chip8->memory[chip8->PC] << 8) | chip8->memory[chip8->PC + 1];
-    if (chip8->debug_state) {
-        printf("The current instruction is at Address: 0x%04X with opcode: 0x%04X\n", chip8->PC-2, instruction->opcode);
+static void op_00FC(chip8_t *chip8, const instruction_t *instruction) {                 // 0x00FC
+    (void)instruction;
+    const uint32_t words = chip8->window_width / 64;
+    for (uint8_t plane = 0; plane < CHIP8_PLANES; plane++) {
+        if (!selected(chip8, plane)) {
+            continue;
+        }
+        for (uint32_t y = 0; y < chip8->window_height; y++) {                               // Scroll left 4 pixels
+            uint64_t (*row)[CHIP8_PLANES] = chip8->display[y];
+            for (uint32_t i = 0; i + 1 < words; i++) {
+                row[i][plane] = row[i][plane] << 4 | row[i + 1][plane] >> 60;
+            }
+            row[words - 1][plane] <<= 4;
+        }
+    }
+    chip8->dirty_rows |= all_rows(chip8);
+}
+
+static void op_00FD(chip8_t *chip8, const instruction_t *instruction) {                 // 0x00FD
+    (void)instruction;
+    chip8->PC -= 2;                                                                         // Exit: stay on this instruction from now on
+}
+
+// Switch resolution, clearing every plane
+static void set_resolution(chip8_t *chip8, bool hires) {
+    chip8->hires = hires;
+    chip8->window_width = hires ? 128 : 64;
+    chip8->window_height = hires ? 64 : 32;
+    memset(chip8->display, 0, sizeof chip8->display);
+    chip8->dirty_rows = ~0ull;
+}
+
+static void op_00FE(chip8_t *chip8, const instruction_t *instruction) {                 // 0x00FE
+    (void)instruction;
+    set_resolution(chip8, false);
+}
+
+static void op_00FF(chip8_t *chip8, const instruction_t *instruction) {                 // 0x00FF
+    (void)instruction;
+    set_resolution(chip8, true);
+}
+
+static void op_00EE(chip8_t *chip8, const instruction_t *instruction) {                 // 0x00EE
+    if (chip8->SP == &chip8->stack[0]) {                                                    // Return with an empty stack
+        op_invalid(chip8, instruction);
+        return;
+    }
+    chip8->PC = *--chip8->SP;
+}
+
+static void op_1NNN(chip8_t *chip8, const instruction_t *instruction) {                 // 0x1NNN
+    chip8->PC = instruction->NNN;
+}
+
+static void op_2NNN(chip8_t *chip8, const instruction_t *instruction) {                 // 0x2NNN
+    if (chip8->SP == &chip8->stack[sizeof chip8->stack / sizeof chip8->stack[0]]) {         // Call with a full stack
+        op_invalid(chip8, instruction);
+        return;
+    }
+    *chip8->SP++ = chip8->PC;
+    chip8->PC = instruction->NNN;
+}
+
+// Step over the next instruction, which is four bytes long if it is the XO-Chip 0xF000 NNNN
+static inline void skip_instruction(chip8_t *chip8) {
+    if (chip8->mode == MODE_XOCHIP && read_memory(chip8, chip8->PC) == 0xF0 && read_memory(chip8, chip8->PC + 1) == 0x00) {
+        chip8->PC += 2;
     }
     chip8->PC += 2;
-    instruction->NNN = instruction->opcode & 0x0FFF;                                        // Mask upper 4 bits
-    instruction->NN = instruction->opcode & 0x00FF;                                         // Mask upper 8 bits
-    instruction->N = instruction->opcode & 0x000F;                                          // Mask upper 12 bits
-    instruction->X = (instruction->opcode >> 8) & 0x0F;                                     // Shift 8 bits to the right and then mask
-    instruction->Y = (instruction->opcode >> 4) & 0x0F;                                     // Shift 4 bits to the right and then mask
-    switch (instruction->opcode & 0xF000) {
-        case 0x0000:
-            if (instruction->NN == 0xE0) {                                                  // 0x00E0
-                for (int i = 0; i < chip8->window_width * chip8->window_height; i++) {
-                    chip8->display[i] = false;
-                }
-                chip8->draw = true;
-            }
-            else if (instruction->NN == 0xEE) {                                             // 0x00EE
-                chip8->PC = *--chip8->SP;
-            }
-            break;
-        case 0x1000:                                                                        // 0x1NNN
-            chip8->PC = instruction->NNN;
-            break;
-        case 0x2000:                                                                        // 0x2NNN
-            *chip8->SP++ = chip8->PC;
-            chip8->PC = instruction->NNN;
-            break;
-        case 0x3000:                                                                        // 0x3XNN
-            if (chip8->V[instruction->X] == instruction->NN) {
-                chip8->PC += 2;
-            }
-            break;
-        case 0x4000:                                                                        // 0x4XNN
-            if (chip8->V[instruction->X] != instruction->NN) {
-                chip8->PC += 2;
-            }
-            break;
-        case 0x5000:                                                                        // 0x5XY0
-            if (chip8->V[instruction->X] == chip8->V[instruction->Y]) {
-                chip8->PC += 2;
-            }
-            break;
-        case 0x6000:                                                                        // 0x6XNN
-            chip8->V[instruction->X] = instruction->NN;
-            break;
-        case 0x7000:                                                                        // 0x7XNN
-            chip8->V[instruction->X] += instruction->NN;
-            break;
-        case 0x8000:
-            switch (instruction->N) {
-                case 0:                                                                     // 0x8XY0
-                    chip8->V[instruction->X] = chip8->V[instruction->Y];
-                    break;
-                case 1:                                                                     // 0x8XY1
-                    chip8->V[instruction->X] |= chip8->V[instruction->Y];
-                    chip8->V[0xF] = 0;
-                    break;
-                case 2:                                                                     // 0x8XY2
-                    chip8->V[instruction->X] &= chip8->V[instruction->Y];
-                    chip8->V[0xF] = 0;
-                    break;
-                case 3:                                                                     // 0x8XY3
-                    chip8->V[instruction->X] ^= chip8->V[instruction->Y];
-                    chip8->V[0xF] = 0;
-                    break;
-                case 4:                                                                     // 0x8XY4
-                    carry = ((uint16_t)(chip8->V[instruction->X] + chip8->V[instruction->Y]) > 255);
-                    chip8->V[instruction->X] += chip8->V[instruction->Y];
-                    chip8->V[0xF] = carry;
-                    break;
-                case 5:                                                                     // 0x8XY5
-                    carry = (chip8->V[instruction->Y] <= chip8->V[instruction->X]);
-                    chip8->V[instruction->X] -= chip8->V[instruction->Y];
-                    chip8->V[0xF] = carry;
-                    break;
-                case 6:                                                                     // 0x8XY6
-                    carry = chip8->V[instruction->Y] & 1;
-                    chip8->V[instruction->X] = chip8->V[instruction->Y] >> 1;
-                    chip8->V[0xF] = carry;
-                    break;
-                case 7:                                                                     // 0x8XY7
-                    carry = (chip8->V[instruction->X] <= chip8->V[instruction->Y]);
-                    chip8->V[instruction->X] = chip8->V[instruction->Y] - chip8->V[instruction->X];
-                    chip8->V[0xF] = carry;
-                    break;
-                case 0xE:                                                                   // 0x8XYE
-                    carry = (chip8->V[instruction->Y] & 0x80) >> 7;
-                    chip8->V[instruction->X] = chip8->V[instruction->Y] << 1;
-                    chip8->V[0xF] = carry;
-                    break;
-                default:
-                    break;
-            }
-            break;
-        case 0x9000:                                                                        // 0x9XY0
-            if (chip8->V[instruction->X] != chip8->V[instruction->Y]) {
-                chip8->PC += 2;
-            }
-            break;
-        case 0xA000:                                                                        // 0xANNN
-            chip8->I = instruction->NNN;
-            break;
-        case 0xB000:                                                                        // 0xBNNN
-            chip8->PC = chip8->V[0] + instruction->NNN;
-            break;
-        case 0xC000:                                                                        // 0xCXNN
-            chip8->V[instruction->X] = (rand() % 256) & instruction->NN;
-            break;
-        case 0xD000: {                                                                      // 0xDXYN
-            uint8_t x_coordinate = chip8->V[instruction->X] % chip8->window_width;
-            uint8_t y_coordinate = chip8->V[instruction->Y] % chip8->window_height;
-            const uint8_t x_original = x_coordinate;
-            chip8->V[0xF] = 0;
-            for (uint8_t i = 0; i < instruction->N; i++) {
-                const uint8_t sprite_data = chip8->memory[chip8->I + i];
-                x_coordinate = x_original;
-                for (int8_t j = 7; j>= 0; j--) {
-                    bool *pixel_index = &chip8->display[y_coordinate * chip8->window_width + x_coordinate];
-                    const bool sprite_bit = (sprite_data & (1 << j));
-                    if (sprite_bit && *pixel_index) {
-                        chip8->V[0xF] = 1;
-                    }
-                    *pixel_index ^= sprite_bit;
-                    if (++x_coordinate >= chip8->window_width) {
-                        break;
-                    }
-                }
-                if (++y_coordinate >= chip8->window_height) {
-                    break;
-                }
-            }
-            chip8->draw = true;
+}
+
+static void op_3XNN(chip8_t *chip8, const instruction_t *instruction) {                 // 0x3XNN
+    if (chip8->V[instruction->X] == instruction->NN) {
+        skip_instruction(chip8);
+    }
+}
+
+static void op_4XNN(chip8_t *chip8, const instruction_t *instruction) {                 // 0x4XNN
+    if (chip8->V[instruction->X] != instruction->NN) {
+        skip_instruction(chip8);
+    }
+}
+
+static void op_5XY0(chip8_t *chip8, const instruction_t *instruction) {                 // 0x5XY0
+    if (chip8->V[instruction->X] == chip8->V[instruction->Y]) {
+        skip_instruction(chip8);
+    }
+}
+
+static void op_5XY2(chip8_t *chip8, const instruction_t *instruction) {                 // 0x5XY2
+    const int8_t step = instruction->X <= instruction->Y ? 1 : -1;                          // Saved in reverse order when X > Y
+    for (uint8_t i = 0, reg = instruction->X; ; i++, reg += step) {
+        write_memory(chip8, chip8->I + i, chip8->V[reg]);
+        if (reg == instruction->Y) {
             break;
         }
-        case 0xE000:
-            if (instruction->NN == 0x9E) {                                                  // 0xEX9E
-                if (chip8->keypad[chip8->V[instruction->X]]) {
-                    chip8->PC += 2;
-                }
-            }
-            else if (instruction->NN == 0xA1) {                                             // 0xEXA1
-                if (!chip8->keypad[chip8->V[instruction->X]]) {
-                    chip8->PC += 2;
-                }
-            }
-            break;
-        case 0xF000:
-            switch (instruction->NN) {
-                case 0x0A: {                                                                // 0xFX0A
-                    static bool any_key_pressed = false;
-                    static uint8_t key = 0xFF;
-                    for (uint8_t i = 0; key == 0xFF && i < sizeof chip8->keypad; i++) {
-                        if (chip8->keypad[i]) {
-                            key = i;
-                            any_key_pressed = true;
-                            break;
-                        }
-                    }
-                    if (!any_key_pressed) {
-                        chip8->PC -= 2;
-                    }
-                    else {
-                        if (chip8->keypad[key]) {
-                            chip8->PC -= 2;
-                        }
-                        else {
-                            chip8->V[instruction->X] = key;
-                            key = 0xFF;
-                            any_key_pressed = false;
-                        }
-                    }
-                    break;
-                }
-                case 0x1E:                                                                  // 0xFX1E
-                    chip8->I += chip8->V[instruction->X];
-                    break;
-                case 0x07:                                                                  // 0xFX07
-                    chip8->V[instruction->X] = chip8->delay_timer;
-                    break;
-                case 0x15:                                                                  // 0xFX15
-                    chip8->delay_timer = chip8->V[instruction->X];
-                    break;
-                case 0x18:                                                                  // 0xFX18
-                    chip8->sound_timer = chip8->V[instruction->X];
-                    break;
-                case 0x29:                                                                  // 0xFX29
-                    chip8->I = chip8->V[instruction->X] * 5;
-                    break;
-                case 0x33:                                                                  // 0xFX33
-                    uint8_t bcd = chip8->V[instruction->X];
-                    chip8->memory[chip8->I + 2] = bcd %10;
-                    bcd /= 10;
-                    chip8->memory[chip8->I + 1] = bcd %10;
-                    bcd /= 10;
-                    chip8->memory[chip8->I] = bcd;
-                    break;
-                case 0x55:                                                                  // 0xFX55
-                    for (uint8_t i = 0; i <= instruction->X; i++) {
-                        chip8->memory[chip8->I++] = chip8->V[i];
-                    }
-                    break;
-                case 0x65:                                                                  // 0xFX65
-                    for (uint8_t i = 0; i <= instruction->X; i++) {
-                        chip8->V[i] = chip8->memory[chip8->I++];
-                    }
-                    break;
-                default:
-                    break;
-            }
-            break;
-        default:
-            if (chip8->debug_state == 1) {
-                printf("Unimplemented/Invalid opcode: 0x%04X", instruction->opcode);
-            }
+    }
+}
+
+static void op_5XY3(chip8_t *chip8, const instruction_t *instruction) {                 // 0x5XY3
+    const int8_t step = instruction->X <= instruction->Y ? 1 : -1;
+    for (uint8_t i = 0, reg = instruction->X; ; i++, reg += step) {
+        chip8->V[reg] = read_memory(chip8, chip8->I + i);
+        if (reg == instruction->Y) {
             break;
+        }
+    }
+}
+
+static void op_6XNN(chip8_t *chip8, const instruction_t *instruction) {                 // 0x6XNN
+    chip8->V[instruction->X] = instruction->NN;
+}
+
+static void op_7XNN(chip8_t *chip8, const instruction_t *instruction) {                 // 0x7XNN
+    chip8->V[instruction->X] += instruction->NN;
+}
+
+static void op_8XY0(chip8_t *chip8, const instruction_t *instruction) {                 // 0x8XY0
+    chip8->V[instruction->X] = chip8->V[instruction->Y];
+}
+
+// 0x8XY1-0x8XY3, specialized on whether VF is cleared as the original interpreter's did
+static inline void logic(chip8_t *chip8, const instruction_t *instruction, uint8_t result, bool vf_reset) {
+    chip8->V[instruction->X] = result;
+    if (vf_reset) {
+        chip8->V[0xF] = 0;
+    }
+}
+
+static void op_8XY1(chip8_t *chip8, const instruction_t *instruction) {                 // 0x8XY1
+    logic(chip8, instruction, chip8->V[instruction->X] | chip8->V[instruction->Y], true);
+}
+
+static void op_8XY2(chip8_t *chip8, const instruction_t *instruction) {                 // 0x8XY2
+    logic(chip8, instruction, chip8->V[instruction->X] & chip8->V[instruction->Y], true);
+}
+
+static void op_8XY3(chip8_t *chip8, const instruction_t *instruction) {                 // 0x8XY3
+    logic(chip8, instruction, chip8->V[instruction->X] ^ chip8->V[instruction->Y], true);
+}
+
+static void op_8XY1_NOVF(chip8_t *chip8, const instruction_t *instruction) {            // 0x8XY1, VF kept
+    logic(chip8, instruction, chip8->V[instruction->X] | chip8->V[instruction->Y], false);
+}
+
+static void op_8XY2_NOVF(chip8_t *chip8, const instruction_t *instruction) {            // 0x8XY2, VF kept
+    logic(chip8, instruction, chip8->V[instruction->X] & chip8->V[instruction->Y], false);
+}
+
+static void op_8XY3_NOVF(chip8_t *chip8, const instruction_t *instruction) {            // 0x8XY3, VF kept
+    logic(chip8, instruction, chip8->V[instruction->X] ^ chip8->V[instruction->Y], false);
+}
+
+static void op_8XY4(chip8_t *chip8, const instruction_t *instruction) {                 // 0x8XY4
+    const bool carry = ((uint16_t)(chip8->V[instruction->X] + chip8->V[instruction->Y]) > 255);
+    chip8->V[instruction->X] += chip8->V[instruction->Y];
+    chip8->V[0xF] = carry;
+}
+
+static void op_8XY5(chip8_t *chip8, const instruction_t *instruction) {                 // 0x8XY5
+    const bool carry = (chip8->V[instruction->Y] <= chip8->V[instruction->X]);
+    chip8->V[instruction->X] -= chip8->V[instruction->Y];
+    chip8->V[0xF] = carry;
+}
+
+// 0x8XY6, specialized on whether VX is shifted in place or VY is shifted into it
+static inline void shift_right(chip8_t *chip8, const instruction_t *instruction, bool in_place) {
+    const uint8_t source = chip8->V[in_place ? instruction->X : instruction->Y];
+    chip8->V[instruction->X] = source >> 1;
+    chip8->V[0xF] = source & 1;
+}
+
+// 0x8XYE, specialized the same way
+static inline void shift_left(chip8_t *chip8, const instruction_t *instruction, bool in_place) {
+    const uint8_t source = chip8->V[in_place ? instruction->X : instruction->Y];
+    chip8->V[instruction->X] = source << 1;
+    chip8->V[0xF] = source >> 7;
+}
+
+static void op_8XY6(chip8_t *chip8, const instruction_t *instruction) {                 // 0x8XY6
+    shift_right(chip8, instruction, false);
+}
+
+static void op_8XY6_VX(chip8_t *chip8, const instruction_t *instruction) {              // 0x8XY6, VX in place
+    shift_right(chip8, instruction, true);
+}
+
+static void op_8XY7(chip8_t *chip8, const instruction_t *instruction) {                 // 0x8XY7
+    const bool carry = (chip8->V[instruction->X] <= chip8->V[instruction->Y]);
+    chip8->V[instruction->X] = chip8->V[instruction->Y] - chip8->V[instruction->X];
+    chip8->V[0xF] = carry;
+}
+
+static void op_8XYE(chip8_t *chip8, const instruction_t *instruction) {                 // 0x8XYE
+    shift_left(chip8, instruction, false);
+}
+
+static void op_8XYE_VX(chip8_t *chip8, const instruction_t *instruction) {              // 0x8XYE, VX in place
+    shift_left(chip8, instruction, true);
+}
+
+static void op_9XY0(chip8_t *chip8, const instruction_t *instruction) {                 // 0x9XY0
+    if (chip8->V[instruction->X] != chip8->V[instruction->Y]) {
+        skip_instruction(chip8);
     }
 }
 
-// Main
-int main(int argc, char **argv) {
-    const char *rom_name = argv[1];                                                         // Take input for rom name
-    clock_t start_time, end_time;
-    chip8_t chip8;
-    sdl_t sdl;
-    initialize_chip8(&chip8, rom_name);
-    initialize_sdl(&sdl, &chip8);
-    clear_screen(&sdl);
-    srand(time(NULL));
-    instruction_t instruction;
-    while (chip8.state != 0) {                                                              // Loop through the instructions until exiting the program
-        handle_input(&chip8, rom_name);
-        if (chip8.state == 2) {
-            update_screen(&sdl, &chip8);                                                    // Update the screen to show Paused/Unpaused state
+static void op_ANNN(chip8_t *chip8, const instruction_t *instruction) {                 // 0xANNN
+    chip8->I = instruction->NNN;
+}
+
+static void op_BNNN(chip8_t *chip8, const instruction_t *instruction) {                 // 0xBNNN
+    chip8->PC = chip8->V[0] + instruction->NNN;
+}
+
+static void op_BXNN(chip8_t *chip8, const instruction_t *instruction) {                 // 0xBXNN, SuperChip's reading of 0xBNNN
+    chip8->PC = chip8->V[instruction->X] + instruction->NNN;
+}
+
+static void op_CXNN(chip8_t *chip8, const instruction_t *instruction) {                 // 0xCXNN
+    chip8->V[instruction->X] = next_random(chip8) & instruction->NN;
+}
+
+// 0xDXYN, specialized on whether sprites clip at the edges or wrap around to the other side
+static inline void draw_sprite(chip8_t *chip8, const instruction_t *instruction, bool wrap) {
+    const uint8_t x_coordinate = chip8->V[instruction->X] % chip8->window_width;
+    const uint8_t y_coordinate = chip8->V[instruction->Y] % chip8->window_height;
+    const bool wide = instruction->N == 0 && chip8->mode != MODE_CHIP8;                     // SuperChip 0xDXY0, 16x16
+    uint8_t rows = wide ? 16 : instruction->N;
+    if (!wrap && rows > chip8->window_height - y_coordinate) {                              // Clip at the bottom edge
+        rows = chip8->window_height - y_coordinate;
+    }
+    const uint32_t words = chip8->window_width / 64;
+    const uint32_t word = x_coordinate >> 6;
+    const uint32_t shift = x_coordinate & 63;
+    const uint32_t next = wrap ? (word + 1) % words : word + 1;                            // Word the part past this one goes to
+    const bool straddles = shift != 0 && (wrap || next < words);
+    uint16_t source = chip8->I;
+    uint64_t collision = 0;
+    for (uint8_t plane = 0; plane < CHIP8_PLANES; plane++) {                                // Each selected plane takes the next sprite in memory
+        if (!selected(chip8, plane)) {
             continue;
         }
-        start_time = clock();
-        for (uint32_t i = 0; i < chip8.emulation_rate; i++) {                               // Emulate upto 600 instructions in a row or until the display needs a refresh
-            emulate_instruction(&chip8, &instruction);
-            if (instruction.opcode >> 12 == (0xD | 0x0)) {
-                break;
+        if (!wide && !straddles) {                                                          // Every low resolution clipped sprite: one word per row
+            for (uint8_t i = 0; i < rows; i++) {
+                const uint32_t y = wrap ? (y_coordinate + i) & (chip8->window_height - 1) : y_coordinate + i;
+                const uint64_t sprite = (uint64_t)read_memory(chip8, source + i) << 56 >> shift;
+                uint64_t *display_word = &chip8->display[y][word][plane];
+                collision |= *display_word & sprite;
+                *display_word ^= sprite;
+                chip8->dirty_rows |= (uint64_t)(sprite != 0) << y;
             }
         }
-        update_screen(&sdl, &chip8);                                                        // Update the screen when 0xDXYN or 0x00E0 instructions are encountered
-        chip8.draw = false;
-        end_time = clock();
-        if (chip8.debug_state == 0) {
-            SDL_Delay(16.67f - (end_time - start_time));                                    // Artificial delay to allow for reasonable emulation speed
-        }
         else {
-            SDL_Delay(1000);
+            for (uint8_t i = 0; i < rows; i++) {
+                const uint32_t y = wrap ? (y_coordinate + i) & (chip8->window_height - 1) : y_coordinate + i;
+                const uint64_t sprite = wide ? (uint64_t)(read_memory(chip8, source + 2 * i) << 8 | read_memory(chip8, source + 2 * i + 1)) << 48
+                                             : (uint64_t)read_memory(chip8, source + i) << 56;
+                uint64_t (*display_row)[CHIP8_PLANES] = chip8->display[y];
+                const uint64_t left = sprite >> shift;                                      // Bits shifted past the right edge are clipped or wrapped
+                collision |= display_row[word][plane] & left;
+                display_row[word][plane] ^= left;
+                if (straddles) {
+                    const uint64_t right = sprite << (64 - shift);
+                    collision |= display_row[next][plane] & right;
+                    display_row[next][plane] ^= right;
+                }
+                chip8->dirty_rows |= (uint64_t)(sprite != 0) << y;
+            }
         }
-        update_timers(&sdl, &chip8);
+        source += wide ? 32 : instruction->N;
+    }
+    chip8->V[0xF] = collision != 0;
+}
+
+static void op_DXYN(chip8_t *chip8, const instruction_t *instruction) {                 // 0xDXYN
+    draw_sprite(chip8, instruction, false);
+}
+
+static void op_DXYN_WRAP(chip8_t *chip8, const instruction_t *instruction) {            // 0xDXYN, wrapping
+    draw_sprite(chip8, instruction, true);
+}
+
+static void op_EX9E(chip8_t *chip8, const instruction_t *instruction) {                 // 0xEX9E
+    if (chip8->keypad[chip8->V[instruction->X] & 0xF]) {
+        skip_instruction(chip8);
     }
-    quit_all(&sdl);
-    exit(EXIT_FAILURE);                                                                     // Goodbye program
+}
+
+static void op_EXA1(chip8_t *chip8, const instruction_t *instruction) {                 // 0xEXA1
+    if (!chip8->keypad[chip8->V[instruction->X] & 0xF]) {
+        skip_instruction(chip8);
+    }
+}
+
+static void op_FX0A(chip8_t *chip8, const instruction_t *instruction) {                 // 0xFX0A
+    for (uint8_t i = 0; chip8->wait_key == 0xFF && i < sizeof chip8->keypad; i++) {
+        if (chip8->keypad[i]) {
+            chip8->wait_key = i;
+            break;
+        }
+    }
+    chip8->blocked = chip8->wait_key == 0xFF || chip8->keypad[chip8->wait_key];
+    if (chip8->blocked) {                                                                   // Wait for a key to be pressed and then released
+        chip8->PC -= 2;
+    }
+    else {
+        chip8->V[instruction->X] = chip8->wait_key;
+        chip8->wait_key = 0xFF;
+    }
+}
+
+static void op_FX1E(chip8_t *chip8, const instruction_t *instruction) {                 // 0xFX1E
+    chip8->I += chip8->V[instruction->X];
+}
+
+static void op_FX07(chip8_t *chip8, const instruction_t *instruction) {                 // 0xFX07
+    chip8->V[instruction->X] = chip8->delay_timer;
+}
+
+static void op_FX15(chip8_t *chip8, const instruction_t *instruction) {                 // 0xFX15
+    chip8->delay_timer = chip8->V[instruction->X];
+}
+
+static void op_FX18(chip8_t *chip8, const instruction_t *instruction) {                 // 0xFX18
+    chip8->sound_timer = chip8->V[instruction->X];
+}
+
+static void op_FX29(chip8_t *chip8, const instruction_t *instruction) {                 // 0xFX29
+    chip8->I = chip8->V[instruction->X] * 5;
+}
+
+static void op_FX33(chip8_t *chip8, const instruction_t *instruction) {                 // 0xFX33
+    uint8_t bcd = chip8->V[instruction->X];
+    write_memory(chip8, chip8->I + 2, bcd % 10);
+    bcd /= 10;
+    write_memory(chip8, chip8->I + 1, bcd % 10);
+    bcd /= 10;
+    write_memory(chip8, chip8->I, bcd);
+}
+
+static void op_FX55(chip8_t *chip8, const instruction_t *instruction) {                 // 0xFX55
+    for (uint8_t i = 0; i <= instruction->X; i++) {
+        write_memory(chip8, chip8->I++, chip8->V[i]);
+    }
+}
+
+static void op_FX65(chip8_t *chip8, const instruction_t *instruction) {                 // 0xFX65
+    for (uint8_t i = 0; i <= instruction->X; i++) {
+        chip8->V[i] = read_memory(chip8, chip8->I++);
+    }
+}
+
+static void op_FX55_KEEPI(chip8_t *chip8, const instruction_t *instruction) {           // 0xFX55, I kept
+    for (uint8_t i = 0; i <= instruction->X; i++) {
+        write_memory(chip8, chip8->I + i, chip8->V[i]);
+    }
+}
+
+static void op_FX65_KEEPI(chip8_t *chip8, const instruction_t *instruction) {           // 0xFX65, I kept
+    for (uint8_t i = 0; i <= instruction->X; i++) {
+        chip8->V[i] = read_memory(chip8, chip8->I + i);
+    }
+}
+
+static void op_FX30(chip8_t *chip8, const instruction_t *instruction) {                 // 0xFX30
+    chip8->I = BIG_FONT + (chip8->V[instruction->X] % 10) * 10;
+}
+
+static void op_FX75(chip8_t *chip8, const instruction_t *instruction) {                 // 0xFX75
+    memcpy(chip8->flags, chip8->V, instruction->X + 1);
+}
+
+static void op_FX85(chip8_t *chip8, const instruction_t *instruction) {                 // 0xFX85
+    memcpy(chip8->V, chip8->flags, instruction->X + 1);
+}
+
+static void op_F000(chip8_t *chip8, const instruction_t *instruction) {                 // 0xF000 NNNN
+    (void)instruction;
+    chip8->I = read_memory(chip8, chip8->PC) << 8 | read_memory(chip8, chip8->PC + 1);
+    chip8->PC += 2;
+}
+
+static void op_FN01(chip8_t *chip8, const instruction_t *instruction) {                 // 0xFN01
+    chip8->planes = instruction->X & 3;
+}
+
+static void op_F002(chip8_t *chip8, const instruction_t *instruction) {                 // 0xF002
+    (void)instruction;
+    for (uint8_t i = 0; i < sizeof chip8->audio_pattern; i++) {
+        chip8->audio_pattern[i] = read_memory(chip8, chip8->I + i);
+    }
+    chip8->audio_pattern_set = true;
+}
+
+static void op_FX3A(chip8_t *chip8, const instruction_t *instruction) {                 // 0xFX3A
+    chip8->pitch = chip8->V[instruction->X];
+}
+
+// Handler for every op index
+static const handler_t handlers[OP_COUNT] = {
+    [OP_DECODE] = op_decode,
+    [OP_INVALID] = op_invalid,
+#define HANDLER(name) [OP_##name] = op_##name,
+    OPCODES(HANDLER)
+#undef HANDLER
+};
+
+// Split the opcode at address into its fields and pick the handler that executes it
+static void decode_instruction(chip8_t *chip8, decoded_t *entry, uint16_t address) {
+    instruction_t *instruction = &entry->instruction;
+    const uint16_t mask = chip8->memory_size - 1;
+    instruction->opcode = (chip8->memory[address & mask] << 8) | chip8->memory[(address + 1) & mask];
+    instruction->NNN = instruction->opcode & 0x0FFF;                                        // Mask upper 4 bits
+    instruction->NN = instruction->opcode & 0x00FF;                                         // Mask upper 8 bits
+    instruction->N = instruction->opcode & 0x000F;                                          // Mask upper 12 bits
+    instruction->X = (instruction->opcode >> 8) & 0x0F;                                     // Shift 8 bits to the right and then mask
+    instruction->Y = (instruction->opcode >> 4) & 0x0F;                                     // Shift 4 bits to the right and then mask
+    const quirk_profile_t *quirks = &quirk_profiles[chip8->quirks];
+    uint8_t op = OP_INVALID;
+    switch (instruction->opcode & 0xF000) {
+        case 0x0000:
+            if (instruction->NN == 0xE0) {
+                op = OP_00E0;
+            }
+            else if (instruction->NN == 0xEE) {
+                op = OP_00EE;
+            }
+            else if (chip8->mode >= MODE_SUPERCHIP && instruction->X == 0) {
+                switch (instruction->NN) {
+                    case 0xFB: op = OP_00FB; break;
+                    case 0xFC: op = OP_00FC; break;
+                    case 0xFD: op = OP_00FD; break;
+                    case 0xFE: op = OP_00FE; break;
+                    case 0xFF: op = OP_00FF; break;
+                    default:
+                        if (instruction->Y == 0xC) {
+                            op = OP_00CN;
+                        }
+                        else if (instruction->Y == 0xD && chip8->mode == MODE_XOCHIP) {
+                            op = OP_00DN;
+                        }
+                        break;
+                }
+            }
+            break;
+        case 0x1000: op = OP_1NNN; break;
+        case 0x2000: op = OP_2NNN; break;
+        case 0x3000: op = OP_3XNN; break;
+        case 0x4000: op = OP_4XNN; break;
+        case 0x5000:
+            if (chip8->mode == MODE_XOCHIP && instruction->N == 2) {
+                op = OP_5XY2;
+            }
+            else if (chip8->mode == MODE_XOCHIP && instruction->N == 3) {
+                op = OP_5XY3;
+            }
+            else {
+                op = OP_5XY0;
+            }
+            break;
+        case 0x6000: op = OP_6XNN; break;
+        case 0x7000: op = OP_7XNN; break;
+        case 0x8000:
+            switch (instruction->N) {
+                case 0: op = OP_8XY0; break;
+                case 1: op = quirks->vf_reset ? OP_8XY1 : OP_8XY1_NOVF; break;
+                case 2: op = quirks->vf_reset ? OP_8XY2 : OP_8XY2_NOVF; break;
+                case 3: op = quirks->vf_reset ? OP_8XY3 : OP_8XY3_NOVF; break;
+                case 4: op = OP_8XY4; break;
+                case 5: op = OP_8XY5; break;
+                case 6: op = quirks->shift_vx ? OP_8XY6_VX : OP_8XY6; break;
+                case 7: op = OP_8XY7; break;
+                case 0xE: op = quirks->shift_vx ? OP_8XYE_VX : OP_8XYE; break;
+                default: break;
+            }
+            break;
+        case 0x9000: op = OP_9XY0; break;
+        case 0xA000: op = OP_ANNN; break;
+        case 0xB000: op = quirks->jump_vx ? OP_BXNN : OP_BNNN; break;
+        case 0xC000: op = OP_CXNN; break;
+        case 0xD000: op = quirks->wrap ? OP_DXYN_WRAP : OP_DXYN; break;
+        case 0xE000:
+            if (instruction->NN == 0x9E) {
+                op = OP_EX9E;
+            }
+            else if (instruction->NN == 0xA1) {
+                op = OP_EXA1;
+            }
+            break;
+        case 0xF000:
+            switch (instruction->NN) {
+                case 0x0A: op = OP_FX0A; break;
+                case 0x1E: op = OP_FX1E; break;
+                case 0x07: op = OP_FX07; break;
+                case 0x15: op = OP_FX15; break;
+                case 0x18: op = OP_FX18; break;
+                case 0x29: op = OP_FX29; break;
+                case 0x33: op = OP_FX33; break;
+                case 0x55: op = quirks->keep_i ? OP_FX55_KEEPI : OP_FX55; break;
+                case 0x65: op = quirks->keep_i ? OP_FX65_KEEPI : OP_FX65; break;
+                case 0x30: op = chip8->mode >= MODE_SUPERCHIP ? OP_FX30 : OP_INVALID; break;
+                case 0x75: op = chip8->mode >= MODE_SUPERCHIP ? OP_FX75 : OP_INVALID; break;
+                case 0x85: op = chip8->mode >= MODE_SUPERCHIP ? OP_FX85 : OP_INVALID; break;
+                case 0x00: op = chip8->mode == MODE_XOCHIP && instruction->X == 0 ? OP_F000 : OP_INVALID; break;
+                case 0x01: op = chip8->mode == MODE_XOCHIP ? OP_FN01 : OP_INVALID; break;
+                case 0x02: op = chip8->mode == MODE_XOCHIP && instruction->X == 0 ? OP_F002 : OP_INVALID; break;
+                case 0x3A: op = chip8->mode == MODE_XOCHIP ? OP_FX3A : OP_INVALID; break;
+                default: break;
+            }
+            break;
+    }
+    entry->op = op;
+    entry->handler = handlers[op];
+}
+
+// Point an entry back at the decoder
+static inline void mark_stale(decoded_t *entry) {
+    entry->op = OP_DECODE;
+    entry->handler = op_decode;
+}
+
+// Drop the decoded instructions that start at or one byte before address
+static inline void invalidate_address(chip8_t *chip8, uint16_t address) {
+    const uint16_t mask = chip8->memory_size - 1;
+    mark_stale(&chip8->cache[address & mask]);
+    mark_stale(&chip8->cache[(address - 1) & mask]);
+}
+
+// Drop every decoded instruction and compiled block
+void chip8_invalidate_cache(chip8_t *chip8) {
+    for (size_t i = 0; i < chip8->memory_size; i++) {
+        mark_stale(&chip8->cache[i]);
+    }
+    memset(chip8->written_pages, 0xFF, sizeof chip8->written_pages);                       // Whoever wrote memory directly did not mark pages
+    chip8->idle_reject = UINT32_MAX;
+    if (chip8->blocks != NULL) {
+        flush_blocks(chip8->blocks);
+    }
+}
+
+#if CHIP8_PROFILE
+// Current time for the profile counters
+static inline uint64_t profile_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+// Count one execution of op at address that took time
+static inline void profile_count(chip8_t *chip8, uint16_t address, uint8_t op, uint64_t time) {
+    if (chip8->profile == NULL && (chip8->profile = calloc(1, sizeof *chip8->profile)) == NULL) {
+        return;
+    }
+    struct chip8_profile *profile = chip8->profile;
+    profile->op_count[op]++;
+    profile->op_time[op] += time;
+    profile->pc_count[address]++;
+    profile->pc_time[address] += time;
+    profile->pc_op[address] = op;
+}
+#endif
+
+// Fetch the pre-decoded instruction at PC and execute it
+static inline const decoded_t *execute_instruction(chip8_t *chip8) {
+    const uint16_t address = chip8->PC & (chip8->memory_size - 1);
+    const decoded_t *entry = &chip8->cache[address];
+#if CHIP8_PROFILE
+    const uint64_t start = profile_clock();
+#endif
+    chip8->PC += 2;
+    entry->handler(chip8, &entry->instruction);
+#if CHIP8_PROFILE
+    profile_count(chip8, address, entry->op, profile_clock() - start);                       // A cache miss was decoded in place, so this is the real opcode
+#endif
+    if (chip8->trace != NULL) {
+        chip8_trace_record(chip8->trace, address, entry->instruction.opcode, chip8);
+    }
+    return entry;
+}
+
+// Emulate one instruction
+void emulate_instruction(chip8_t *chip8, instruction_t *instruction) {
+    *instruction = execute_instruction(chip8)->instruction;
+}
+
+// Whether op draws, ending the frame when display_wait is set
+static inline bool is_draw(uint8_t op) {
+    return op == OP_DXYN || op == OP_DXYN_WRAP;
+}
+
+// Longest loop searched for a fixed point, in instructions per pass
+#define IDLE_MAX 16
+
+// Fast-forward the loop starting at PC if it is idle. Run one pass on copies of V and I, giving up at the first
+// opcode other than 0x1NNN, 0x3XNN, 0x4XNN, 0x5XY0, 0x6XNN, 0x8XY0, 0x9XY0, 0xANNN, 0xEX9E, 0xEXA1 and 0xFX07.
+// Nothing those read changes during a step, so a pass that comes back to PC with V and I as they were is what every
+// following pass does too: count as many whole passes as fit in cycles without running them. Returns the new count
+static uint32_t skip_idle(chip8_t *chip8, uint32_t executed, uint32_t cycles) {
+    const uint16_t mask = chip8->memory_size - 1;
+    const uint16_t start = chip8->PC & mask;
+    if (start == chip8->idle_reject) {
+        return executed;
+    }
+    uint8_t V[16];
+    memcpy(V, chip8->V, sizeof V);
+    uint16_t I = chip8->I;
+    uint16_t address = start;
+    bool tested = false;                                                                    // A skip ran, so what follows may not run every pass
+    bool input = false;                                                                     // The pass read the delay timer or keypad
+    for (uint32_t length = 1; length <= IDLE_MAX; length++) {
+        const uint16_t opcode = read_memory(chip8, address) << 8 | read_memory(chip8, address + 1);
+        const uint8_t X = (opcode >> 8) & 0xF;
+        const uint8_t NN = opcode & 0xFF;
+        bool known = true;
+        bool skip = false;
+        address = (address + 2) & mask;
+        switch (opcode >> 12) {
+            case 0x1:
+                address = opcode & 0xFFF;
+                break;
+            case 0x3:
+            case 0x4:
+                tested = true;
+                skip = (V[X] == NN) == (opcode >> 12 == 0x3);
+                break;
+            case 0x5:
+            case 0x9:
+                tested = true;
+                known = (opcode & 0xF) == 0;
+                skip = (V[X] == V[(opcode >> 4) & 0xF]) == (opcode >> 12 == 0x5);
+                break;
+            case 0x6:
+                V[X] = NN;
+                break;
+            case 0x8:
+                known = (opcode & 0xF) == 0;
+                V[X] = V[(opcode >> 4) & 0xF];
+                break;
+            case 0xA:
+                I = opcode & 0xFFF;
+                break;
+            case 0xE:
+                tested = true;
+                input = true;
+                known = (NN == 0x9E || NN == 0xA1) && V[X] < sizeof chip8->keypad;
+                skip = chip8->keypad[V[X] & 0xF] == (NN == 0x9E);
+                break;
+            case 0xF:
+                input = true;
+                known = NN == 0x07;
+                V[X] = chip8->delay_timer;
+                break;
+            default:
+                known = false;
+                break;
+        }
+        if (!known) {
+            if (!tested) {                                                                  // Every pass gets here, no point looking again
+                chip8->idle_reject = start;
+            }
+            return executed;
+        }
+        if (skip) {
+            const bool long_skip = chip8->mode == MODE_XOCHIP && read_memory(chip8, address) == 0xF0 && read_memory(chip8, address + 1) == 0x00;
+            address = (address + (long_skip ? 4 : 2)) & mask;
+        }
+        if (address == start) {
+            if (memcmp(V, chip8->V, sizeof V) != 0 || I != chip8->I) {
+                return executed;
+            }
+            chip8->halted |= !input;
+            return executed + (cycles - executed) / length * length;
+        }
+    }
+    return executed;
+}
+
+// Whether op was an 0xFX0A that is still waiting, which it will be until the keypad changes after the step
+static inline bool blocked(const chip8_t *chip8, uint8_t op) {
+    return op == OP_FX0A && chip8->blocked && chip8->skip_idle;
+}
+
+// Whether the 0x1NNN in entry jumped back, to a loop skip_idle should look at
+static inline bool looped(const chip8_t *chip8, const decoded_t *entry) {
+    return chip8->skip_idle && (chip8->PC & (chip8->memory_size - 1)) <= entry - chip8->cache;
+}
+
+// Handler dispatch: one indirect call through the cache entry per instruction
+static uint32_t step_cached(chip8_t *chip8, uint32_t cycles) {
+    uint32_t executed = 0;
+    while (executed < cycles) {
+        executed++;
+        const decoded_t *entry = execute_instruction(chip8);
+        if (is_draw(entry->op) && chip8->display_wait) {
+            break;
+        }
+        if (CHIP8_PROFILE || chip8->trace != NULL) {                                        // Traces and profiles count every instruction
+            continue;
+        }
+        if (entry->op == OP_1NNN && looped(chip8, entry)) {
+            executed = skip_idle(chip8, executed, cycles);
+        }
+        else if (blocked(chip8, entry->op)) {
+            return cycles;
+        }
+    }
+    return executed;
+}
+
+// Whether any address from first to first + length - 1 is set in bitmap, wrapping at the end of memory
+static bool test_range(const uint64_t *bitmap, uint16_t first, uint16_t length, uint16_t mask, uint16_t *hit) {
+    for (uint16_t i = 0; i < length; i++) {
+        const uint16_t address = (first + i) & mask;
+        if (bitmap[address >> 6] & (1ull << (address & 63))) {
+            *hit = address;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Memory the instruction of entry is about to read or write, fetches aside. Returns false if it touches none
+static bool memory_access(const chip8_t *chip8, const decoded_t *entry, uint16_t *first, uint16_t *length, bool *write) {
+    const instruction_t *instruction = &entry->instruction;
+    *first = chip8->I;
+    *write = false;
+    switch (entry->op) {
+        case OP_DXYN:
+        case OP_DXYN_WRAP: {
+            const uint8_t y_coordinate = chip8->V[instruction->Y] % chip8->window_height;
+            const bool wide = instruction->N == 0 && chip8->mode != MODE_CHIP8;
+            const uint8_t rows = wide ? 16 : instruction->N;
+            const uint8_t clipped = entry->op == OP_DXYN && rows > chip8->window_height - y_coordinate ? chip8->window_height - y_coordinate : rows;
+            const uint8_t planes = (chip8->planes & 1) + (chip8->planes >> 1);              // Earlier planes read their whole sprite, the last one up to the clip
+            if (planes == 0) {
+                return false;
+            }
+            *length = ((planes - 1) * rows + clipped) * (wide ? 2 : 1);
+            return true;
+        }
+        case OP_5XY3:
+        case OP_5XY2:
+            *length = (instruction->X > instruction->Y ? instruction->X - instruction->Y : instruction->Y - instruction->X) + 1;
+            *write = entry->op == OP_5XY2;
+            return true;
+        case OP_FX65:
+        case OP_FX65_KEEPI:
+            *length = instruction->X + 1;
+            return true;
+        case OP_FX33:
+            *length = 3;
+            *write = true;
+            return true;
+        case OP_FX55:
+        case OP_FX55_KEEPI:
+            *length = instruction->X + 1;
+            *write = true;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Debug dispatch: the cached loop with breakpoint, watchpoint and register checks around each instruction.
+// chip8_step only runs it while something is armed. An instruction that stopped the last step runs unchecked,
+// so resuming moves past the breakpoint
+static uint32_t step_debug(chip8_t *chip8, uint32_t cycles) {
+    const struct chip8_breakpoints *breakpoints = chip8->breakpoints;
+    const uint16_t mask = chip8->memory_size - 1;
+    bool resume = chip8->break_reason != CHIP8_BREAK_NONE && chip8->break_reason != CHIP8_BREAK_REGISTER;
+    chip8->break_reason = CHIP8_BREAK_NONE;
+    uint32_t executed = 0;
+    while (executed < cycles) {
+        const uint16_t address = chip8->PC & mask;
+        decoded_t *entry = &chip8->cache[address];
+        if (entry->op == OP_DECODE) {
+            decode_instruction(chip8, entry, address);
+        }
+        if (!resume) {
+            uint16_t first, length, hit;
+            bool write;
+            if (breakpoints->pc[address >> 6] & (1ull << (address & 63))) {
+                chip8->break_reason = CHIP8_BREAK_PC;
+                chip8->break_address = address;
+                break;
+            }
+            if (memory_access(chip8, entry, &first, &length, &write) && test_range(write ? breakpoints->write : breakpoints->read, first, length, mask, &hit)) {
+                chip8->break_reason = write ? CHIP8_BREAK_WRITE : CHIP8_BREAK_READ;
+                chip8->break_address = hit;
+                break;
+            }
+        }
+        resume = false;
+        uint8_t V[16];
+        const uint16_t I = chip8->I;
+        memcpy(V, chip8->V, sizeof V);
+        executed++;
+        const bool drew = is_draw(execute_instruction(chip8)->op);
+        if (breakpoints->registers != 0) {
+            for (uint8_t i = 0; i < 17; i++) {
+                if ((breakpoints->registers >> i) & 1 && (i == 16 ? chip8->I != I : chip8->V[i] != V[i])) {
+                    chip8->break_reason = CHIP8_BREAK_REGISTER;
+                    chip8->break_address = i;
+                    return executed;
+                }
+            }
+        }
+        if (drew && chip8->display_wait) {
+            break;
+        }
+    }
+    return executed;
+}
+
+#if defined(__GNUC__)
+// Threaded dispatch: every handler body ends in its own computed goto to the next one,
+// so the branch predictor sees one indirect jump per opcode instead of a single shared one
+static uint32_t step_threaded(chip8_t *chip8, uint32_t cycles) {
+#define LABEL(name) [OP_##name] = &&label_##name,
+    static const void *const labels[OP_COUNT] = {
+        [OP_DECODE] = &&label_decode,
+        [OP_INVALID] = &&label_invalid,
+        OPCODES(LABEL)
+    };
+#undef LABEL
+    const uint16_t mask = chip8->memory_size - 1;
+    decoded_t *entry;
+    uint32_t executed = 0;
+#define DISPATCH() do {                                     \
+        if (executed == cycles) {                           \
+            return executed;                                \
+        }                                                   \
+        entry = &chip8->cache[chip8->PC & mask];            \
+        chip8->PC += 2;                                     \
+        executed++;                                         \
+        goto *labels[entry->op];                            \
+    } while (0)
+    DISPATCH();
+label_decode:
+    decode_instruction(chip8, entry, chip8->PC - 2);
+    goto *labels[entry->op];
+label_invalid:
+    op_invalid(chip8, &entry->instruction);
+    DISPATCH();
+#define BODY(name)                                          \
+label_##name:                                               \
+    op_##name(chip8, &entry->instruction);                  \
+    if (is_draw(OP_##name) && chip8->display_wait) {        \
+        return executed;                                    \
+    }                                                       \
+    if (OP_##name == OP_1NNN && looped(chip8, entry)) {     \
+        executed = skip_idle(chip8, executed, cycles);      \
+    }                                                       \
+    if (blocked(chip8, OP_##name)) {                        \
+        return cycles;                                      \
+    }                                                       \
+    DISPATCH();
+    OPCODES(BODY)
+#undef BODY
+#undef DISPATCH
+}
+#else
+// Labels as values are a GCC extension, other compilers get handler dispatch
+static uint32_t step_threaded(chip8_t *chip8, uint32_t cycles) {
+    return step_cached(chip8, cycles);
+}
+#endif
+
+// Throw away every compiled block
+static void flush_blocks(struct block_cache *cache) {
+    memset(cache->blocks, 0, sizeof cache->blocks);
+    memset(cache->code_map, 0, sizeof cache->code_map);
+    cache->used = 0;
+}
+
+// Opcodes that can change PC, wait, draw, or write memory end a block
+static inline bool ends_block(uint8_t op) {
+    switch (op) {
+        case OP_00E0: case OP_6XNN: case OP_7XNN: case OP_8XY0: case OP_8XY1: case OP_8XY2:
+        case OP_8XY3: case OP_8XY4: case OP_8XY5: case OP_8XY6: case OP_8XY7: case OP_8XYE:
+        case OP_8XY1_NOVF: case OP_8XY2_NOVF: case OP_8XY3_NOVF: case OP_8XY6_VX: case OP_8XYE_VX: case OP_FX65_KEEPI:
+        case OP_ANNN: case OP_CXNN: case OP_FX1E: case OP_FX07: case OP_FX15: case OP_FX18:
+        case OP_FX29: case OP_FX65: case OP_FX30: case OP_FX75: case OP_FX85: case OP_F002: case OP_FX3A:
+        case OP_5XY3: case OP_FN01:
+            return false;
+        default:
+            return true;
+    }
+}
+
+// Decoded instruction at address, decoding it if the entry is stale
+static inline const decoded_t *decoded_at(chip8_t *chip8, uint16_t address) {
+    decoded_t *entry = &chip8->cache[address];
+    if (entry->op == OP_DECODE) {
+        decode_instruction(chip8, entry, address);
+    }
+    return entry;
+}
+
+// Mark the two bytes of the opcode at address as compiled code
+static inline void map_code(struct block_cache *cache, uint16_t address) {
+    cache->code_map[address >> 3] |= 1 << (address & 7);
+    cache->code_map[(address + 1) >> 3] |= 1 << ((address + 1) & 7);
+}
+
+// Whether the opcode at address may be compiled
+static inline bool compilable(const chip8_t *chip8, uint16_t address) {
+    return address < BLOCK_SPAN - 1 && address < chip8->memory_size - 1 && !(chip8->blocks->smc_pages & (1ull << (address >> 6)));
+}
+
+// Translate the run starting at start into uops, up to and including the opcode that ends it.
+// Unconditional jumps are followed rather than compiled, so a loop body becomes one trace
+static void compile_block(chip8_t *chip8, uint16_t start) {
+    struct block_cache *cache = chip8->blocks;
+    if (cache->used + BLOCK_MAX + 1 > BLOCK_ARENA) {
+        flush_blocks(cache);
+    }
+    block_t *block = &cache->blocks[start];
+    *block = (block_t) {.first = cache->used, .length = 1, .uops = 0};                     // Interpret unless at least one uop gets compiled
+    uint16_t address = start;
+    uint8_t length = 0;
+    while (length < BLOCK_MAX && compilable(chip8, address)) {
+        const decoded_t *entry = decoded_at(chip8, address);
+        if (entry->op == OP_1NNN && entry->instruction.NNN != start && compilable(chip8, entry->instruction.NNN)) {
+            map_code(cache, address);
+            length++;
+            address = entry->instruction.NNN;
+            block->jumped = true;
+            continue;
+        }
+        uop_t *uop = &cache->arena[cache->used++];
+        *uop = (uop_t) {.instruction = entry->instruction, .address = address, .kind = entry->op};
+        map_code(cache, address);
+        length++;
+        if (ends_block(entry->op)) {
+            break;
+        }
+        address += 2;
+        if (entry->op == OP_7XNN && compilable(chip8, address)) {
+            const decoded_t *next = decoded_at(chip8, address);
+            if ((next->op == OP_3XNN || next->op == OP_4XNN) && next->instruction.X == entry->instruction.X) {
+                uop->kind = next->op == OP_3XNN ? FUSED_ADD_SE : FUSED_ADD_SNE;            // Counter loops: add then test the same register
+                uop->compare = next->instruction.NN;
+                uop->address = address;
+                map_code(cache, address);
+                length++;
+                break;
+            }
+        }
+    }
+    if (cache->used == block->first) {
+        return;
+    }
+    const uint8_t kind = cache->arena[cache->used - 1].kind;
+    if (!ends_block(kind) && kind < OP_COUNT && block->jumped) {                            // Ran out of budget or hit an interpreted page after a followed jump, continue at its target.
+        uop_t *fallthrough = &cache->arena[cache->used++];                                  // Without a jump, setting PC past the last opcode is enough
+        *fallthrough = (uop_t) {.instruction = {.NNN = address}, .address = address - 2, .kind = OP_1NNN};
+    }
+    block->uops = cache->used - block->first;
+    cache->arena[cache->used++] = (uop_t) {.kind = UOP_END};
+    block->length = length;
+}
+
+// 0x7XNN then 0x3XKK, PC already points past the skip
+static inline void uop_add_se(chip8_t *chip8, const uop_t *uop) {
+    chip8->V[uop->instruction.X] += uop->instruction.NN;
+    if (chip8->V[uop->instruction.X] == uop->compare) {
+        skip_instruction(chip8);
+    }
+}
+
+// 0x7XNN then 0x4XKK, PC already points past the skip
+static inline void uop_add_sne(chip8_t *chip8, const uop_t *uop) {
+    chip8->V[uop->instruction.X] += uop->instruction.NN;
+    if (chip8->V[uop->instruction.X] != uop->compare) {
+        skip_instruction(chip8);
+    }
+}
+
+#if defined(__GNUC__)
+// Run the uops of a block from first up to its UOP_END, each jumping straight to the next.
+// Labels are resolved into the uops the first time a block runs
+static inline void run_block(chip8_t *chip8, uop_t *uop, const block_t *block) {
+#define LABEL(name) [OP_##name] = &&uop_##name,
+    static const void *const labels[UOP_COUNT] = {
+        [OP_DECODE] = &&uop_invalid,
+        [OP_INVALID] = &&uop_invalid,
+        OPCODES(LABEL)
+        [FUSED_ADD_SE] = &&uop_fused_add_se,
+        [FUSED_ADD_SNE] = &&uop_fused_add_sne,
+        [UOP_END] = &&uop_end,
+    };
+#undef LABEL
+    if (uop->label == NULL) {
+        for (uint16_t i = 0; i <= block->uops; i++) {
+            uop[i].label = labels[uop[i].kind];
+        }
+    }
+    goto *uop->label;
+#define BODY(name)                                          \
+uop_##name:                                                 \
+    op_##name(chip8, &uop->instruction);                    \
+    uop++;                                                  \
+    goto *uop->label;
+    OPCODES(BODY)
+#undef BODY
+uop_invalid:
+    op_invalid(chip8, &uop->instruction);
+    uop++;
+    goto *uop->label;
+uop_fused_add_se:
+    uop_add_se(chip8, uop);
+    uop++;
+    goto *uop->label;
+uop_fused_add_sne:
+    uop_add_sne(chip8, uop);
+    uop++;
+    goto *uop->label;
+uop_end:
+    return;
+}
+#else
+// Run the uops of a block from first up to its UOP_END
+static inline void run_block(chip8_t *chip8, uop_t *uop, const block_t *block) {
+    (void)block;
+    for (; uop->kind != UOP_END; uop++) {
+        switch (uop->kind) {
+#define CASE(name) case OP_##name: op_##name(chip8, &uop->instruction); break;
+            OPCODES(CASE)
+#undef CASE
+            case FUSED_ADD_SE:
+                uop_add_se(chip8, uop);
+                break;
+            case FUSED_ADD_SNE:
+                uop_add_sne(chip8, uop);
+                break;
+            default:
+                op_invalid(chip8, &uop->instruction);
+                break;
+        }
+    }
+}
+#endif
+
+// Block dispatch: run whole compiled blocks, interpreting only when a block does not fit the budget
+static uint32_t step_block(chip8_t *chip8, uint32_t cycles) {
+    if (chip8->blocks == NULL && (chip8->blocks = calloc(1, sizeof *chip8->blocks)) == NULL) {
+        return step_threaded(chip8, cycles);
+    }
+    const uint16_t mask = chip8->memory_size - 1;
+    uint32_t executed = 0;
+    uint32_t previous = UINT32_MAX;
+    while (executed < cycles) {
+        const uint16_t start = chip8->PC & mask;
+        if (start == previous && chip8->skip_idle) {                                        // Jumps inside a block are gone, a loop shows up as the same block twice
+            executed = skip_idle(chip8, executed, cycles);
+            if (executed == cycles) {
+                break;
+            }
+        }
+        previous = start;
+        if (start < BLOCK_SPAN && chip8->blocks->blocks[start].length == 0) {              // XO-Chip code above the span is always interpreted
+            compile_block(chip8, start);
+        }
+        const block_t block = start < BLOCK_SPAN ? chip8->blocks->blocks[start] : (block_t) {0}; // Copied, a write in the last uop can flush the cache
+        if (block.uops == 0 || cycles - executed < block.length) {
+            executed++;
+            const uint8_t op = execute_instruction(chip8)->op;
+            if (is_draw(op) && chip8->display_wait) {
+                break;
+            }
+            if (blocked(chip8, op)) {
+                return cycles;
+            }
+            continue;
+        }
+        uop_t *first = &chip8->blocks->arena[block.first];
+        const uop_t *last = first + block.uops - 1;
+        chip8->PC = (block.jumped ? 0 : chip8->PC - start) + last->address + 2;             // Only the last uop can read PC. Keep the wraps PC made past the end of memory, as the other engines do
+        run_block(chip8, first, &block);
+        executed += block.length;
+        if (is_draw(last->kind) && chip8->display_wait) {
+            break;
+        }
+        if (blocked(chip8, last->kind)) {
+            return cycles;
+        }
+    }
+    return executed;
+}
+
+// Emulate up to cycles instructions, or until a draw when display_wait is set
+uint32_t chip8_step(chip8_t *chip8, uint32_t cycles) {
+    if (chip8->breakpoints != NULL && chip8->breakpoints->armed) {
+        return step_debug(chip8, cycles);
+    }
+    if (chip8->trace != NULL || CHIP8_PROFILE) {                                            // Tracing and profile counters live in execute_instruction
+        return step_cached(chip8, cycles);
+    }
+    switch (chip8->engine) {
+        case ENGINE_THREADED:
+            return step_threaded(chip8, cycles);
+        case ENGINE_BLOCK:
+            return step_block(chip8, cycles);
+        default:
+            return step_cached(chip8, cycles);
+    }
+}
+
+// Human readable name of a dispatch engine
+const char *chip8_engine_name(engine_t engine) {
+    switch (engine) {
+        case ENGINE_CACHED:
+            return "cached";
+        case ENGINE_THREADED:
+#if defined(__GNUC__)
+            return "threaded";
+#else
+            return "threaded (cached fallback)";
+#endif
+        case ENGINE_BLOCK:
+            return "block";
+        default:
+            return "unknown";
+    }
+}
+
+// Switch platforms, dropping decoded instructions since opcodes decode differently
+void chip8_set_mode(chip8_t *chip8, uint8_t mode) {
+    chip8->mode = mode % MODE_COUNT;
+    if (chip8->mode == MODE_CHIP8 && chip8->hires) {                                        // The original chip-8 has no high resolution
+        set_resolution(chip8, false);
+    }
+    if (chip8->mode != MODE_XOCHIP) {                                                       // Nor does anything before XO-Chip have a second plane
+        for (uint32_t y = 0; y < 64; y++) {
+            for (uint32_t word = 0; word < CHIP8_ROW_WORDS; word++) {
+                chip8->display[y][word][1] = 0;
+            }
+        }
+        chip8->planes = 1;
+        chip8->dirty_rows = ~0ull;
+    }
+    const quirks_t quirks[MODE_COUNT] = {[MODE_CHIP8] = QUIRKS_CHIP8, [MODE_SUPERCHIP] = QUIRKS_SCHIP_MODERN, [MODE_XOCHIP] = QUIRKS_XOCHIP};
+    chip8_set_quirks(chip8, quirks[chip8->mode]);                                           // Drops the decoded instructions too
+}
+
+// Human readable name of a platform
+const char *chip8_mode_name(uint8_t mode) {
+    switch (mode) {
+        case MODE_CHIP8:
+            return "chip8";
+        case MODE_SUPERCHIP:
+            return "schip";
+        case MODE_XOCHIP:
+            return "xochip";
+        default:
+            return "unknown";
+    }
+}
+
+// Switch quirk profiles, dropping decoded instructions since the quirky opcodes decode to other variants
+void chip8_set_quirks(chip8_t *chip8, quirks_t quirks) {
+    chip8->quirks = quirks % QUIRKS_COUNT;
+    chip8->display_wait = quirk_profiles[chip8->quirks].display_wait;
+    chip8_invalidate_cache(chip8);
+}
+
+// Human readable name of a quirk profile
+const char *chip8_quirks_name(quirks_t quirks) {
+    switch (quirks) {
+        case QUIRKS_CHIP8:
+            return "chip8";
+        case QUIRKS_SCHIP_LEGACY:
+            return "schip-legacy";
+        case QUIRKS_SCHIP_MODERN:
+            return "schip-modern";
+        case QUIRKS_XOCHIP:
+            return "xochip";
+        default:
+            return "unknown";
+    }
+}
+
+// Instructions to run this 60Hz frame, spreading emulation_rate evenly over every second
+uint32_t chip8_frame_cycles(chip8_t *chip8) {
+    chip8->cycle_credit += chip8->emulation_rate;
+    const uint32_t cycles = chip8->cycle_credit / 60;
+    chip8->cycle_credit %= 60;
+    return cycles;
+}
+
+// Update timers at a rate of 60Hz
+void chip8_update_timers(chip8_t *chip8) {
+    if (chip8->delay_timer > 0) {
+        chip8->delay_timer--;
+    }
+    if (chip8->sound_timer > 0) {
+        chip8->sound_timer--;
+    }
+}
+
+// Save state layout, all fields little-endian:
+//   "C8ST", u16 version, u16 reserved, u32 memory size
+//   V[16], u16 I, u16 PC, u16 stack[16], u8 stack depth, u8 delay timer, u8 sound timer, u8 wait key,
+//   u16 keypad (bit n = key n), u32 cycle credit, u64 random state, u8 audio pattern[16], u8 pattern set,
+//   u8 pitch, u8 high resolution, u8 flags[16], u8 plane mask, u64 display[64][2][2], memory
+#define STATE_HEADER 12
+#define STATE_REGISTERS 106
+#define STATE_DISPLAY (64 * CHIP8_ROW_WORDS * CHIP8_PLANES * 8)
+
+// Bytes a save state of this instance takes
+size_t chip8_state_size(const chip8_t *chip8) {
+    return STATE_HEADER + STATE_REGISTERS + STATE_DISPLAY + chip8->memory_size;
+}
+
+static inline uint8_t *put_le(uint8_t *out, uint64_t value, uint8_t bytes) {
+    for (uint8_t i = 0; i < bytes; i++) {
+        *out++ = value >> (8 * i);
+    }
+    return out;
+}
+
+static inline uint64_t get_le(const uint8_t **in, uint8_t bytes) {
+    uint64_t value = 0;
+    for (uint8_t i = 0; i < bytes; i++) {
+        value |= (uint64_t)*(*in)++ << (8 * i);
+    }
+    return value;
+}
+
+// Write the machine state to buffer
+size_t chip8_save_state(const chip8_t *chip8, uint8_t *buffer, size_t capacity) {
+    const size_t size = chip8_state_size(chip8);
+    if (capacity < size) {
+        return 0;
+    }
+    uint8_t *out = buffer;
+    memcpy(out, "C8ST", 4);
+    out = put_le(out + 4, CHIP8_STATE_VERSION, 2);
+    out = put_le(out, 0, 2);
+    out = put_le(out, chip8->memory_size, 4);
+    memcpy(out, chip8->V, sizeof chip8->V);
+    out = put_le(out + sizeof chip8->V, chip8->I, 2);
+    out = put_le(out, chip8->PC, 2);
+    for (size_t i = 0; i < sizeof chip8->stack / sizeof chip8->stack[0]; i++) {
+        out = put_le(out, chip8->stack[i], 2);
+    }
+    *out++ = chip8->SP - chip8->stack;                                                      // SP points into this instance, store the depth
+    *out++ = chip8->delay_timer;
+    *out++ = chip8->sound_timer;
+    *out++ = chip8->wait_key;
+    uint16_t keys = 0;
+    for (uint8_t i = 0; i < sizeof chip8->keypad; i++) {
+        keys |= chip8->keypad[i] << i;
+    }
+    out = put_le(out, keys, 2);
+    out = put_le(out, chip8->cycle_credit, 4);
+    out = put_le(out, chip8->rng, 8);
+    memcpy(out, chip8->audio_pattern, sizeof chip8->audio_pattern);
+    out += sizeof chip8->audio_pattern;
+    *out++ = chip8->audio_pattern_set;
+    *out++ = chip8->pitch;
+    *out++ = chip8->hires;
+    memcpy(out, chip8->flags, sizeof chip8->flags);
+    out += sizeof chip8->flags;
+    *out++ = chip8->planes;
+    const uint64_t *display = &chip8->display[0][0][0];
+    for (size_t i = 0; i < sizeof chip8->display / sizeof *display; i++) {
+        out = put_le(out, display[i], 8);
+    }
+    memcpy(out, chip8->memory, chip8->memory_size);
+    return size;
+}
+
+// Restore a save state, only dropping the decoded instructions and blocks of bytes that differ
+bool chip8_load_state(chip8_t *chip8, const uint8_t *buffer, size_t size) {
+    const uint8_t *in = buffer + 4;
+    if (size < STATE_HEADER || memcmp(buffer, "C8ST", 4) != 0) {
+        printf("Not a save state\n");
+        return false;
+    }
+    const uint16_t version = get_le(&in, 2);
+    in += 2;
+    const uint32_t memory_size = get_le(&in, 4);
+    if (version != CHIP8_STATE_VERSION) {
+        printf("Save state version %u does not match this build (version %u)\n", version, CHIP8_STATE_VERSION);
+        return false;
+    }
+    const size_t depth = 16 + 2 + 2 + sizeof chip8->stack;                                  // Offset of the stack depth, followed by the timers and the key FX0A waits on
+    if (size != chip8_state_size(chip8) || memory_size != chip8->memory_size || in[depth] > sizeof chip8->stack / sizeof chip8->stack[0]
+        || (in[depth + 3] >= sizeof chip8->keypad && in[depth + 3] != 0xFF)) {
+        printf("Save state is truncated or corrupt\n");
+        return false;
+    }
+    memcpy(chip8->V, in, sizeof chip8->V);
+    in += sizeof chip8->V;
+    chip8->I = get_le(&in, 2);
+    chip8->PC = get_le(&in, 2);
+    for (size_t i = 0; i < sizeof chip8->stack / sizeof chip8->stack[0]; i++) {
+        chip8->stack[i] = get_le(&in, 2);
+    }
+    chip8->SP = &chip8->stack[*in++];
+    chip8->delay_timer = *in++;
+    chip8->sound_timer = *in++;
+    chip8->wait_key = *in++;
+    const uint16_t keys = get_le(&in, 2);
+    for (uint8_t i = 0; i < sizeof chip8->keypad; i++) {
+        chip8->keypad[i] = (keys >> i) & 1;
+    }
+    chip8->cycle_credit = get_le(&in, 4);
+    chip8->rng = get_le(&in, 8);
+    memcpy(chip8->audio_pattern, in, sizeof chip8->audio_pattern);
+    in += sizeof chip8->audio_pattern;
+    chip8->audio_pattern_set = *in++ != 0;
+    chip8->pitch = *in++;
+    if ((*in != 0) != chip8->hires) {                                                       // The frontend redraws everything on a resolution change
+        chip8->dirty_rows = ~0ull;
+    }
+    chip8->hires = *in++ != 0;
+    chip8->window_width = chip8->hires ? 128 : 64;
+    chip8->window_height = chip8->hires ? 64 : 32;
+    memcpy(chip8->flags, in, sizeof chip8->flags);
+    in += sizeof chip8->flags;
+    chip8->planes = *in++ & 3;
+    uint64_t *display = &chip8->display[0][0][0];
+    for (size_t i = 0; i < sizeof chip8->display / sizeof *display; i++) {
+        const uint64_t word = get_le(&in, 8);
+        if (word != display[i]) {
+            display[i] = word;
+            chip8->dirty_rows |= 1ull << (i / (CHIP8_ROW_WORDS * CHIP8_PLANES));
+        }
+    }
+    bool flush = false;
+    for (size_t page = 0; page < chip8->memory_size; page += 64) {                         // Most of memory is unchanged between nearby states
+        if (memcmp(&chip8->memory[page], &in[page], 64) == 0) {
+            continue;
+        }
+        for (size_t address = page; address < page + 64; address++) {
+            if (chip8->memory[address] != in[address]) {
+                chip8->memory[address] = in[address];
+                chip8->written_pages[address >> 12] |= 1ull << ((address >> 6) & 63);
+                invalidate_address(chip8, address);
+                flush |= chip8->blocks != NULL && address < BLOCK_SPAN && chip8->blocks->code_map[address >> 3] & (1 << (address & 7));
+            }
+        }
+    }
+    if (flush) {
+        flush_blocks(chip8->blocks);
+    }
+    chip8->halted = false;
+    chip8->blocked = false;
+    chip8->idle_reject = UINT32_MAX;
+    return true;
+}
+
+// Write a save state to disk
+bool chip8_save_state_file(const chip8_t *chip8, const char state_name[]) {
+    const size_t size = chip8_state_size(chip8);
+    uint8_t *buffer = malloc(size);
+    if (buffer == NULL) {
+        return false;
+    }
+    chip8_save_state(chip8, buffer, size);
+    FILE *state = fopen(state_name, "wb");
+    if (state == NULL) {
+        printf("Could not create save state: %s\n", state_name);
+        free(buffer);
+        return false;
+    }
+    const bool written = fwrite(buffer, 1, size, state) == size;
+    free(buffer);
+    return fclose(state) == 0 && written;
+}
+
+// Restore a save state from disk
+bool chip8_load_state_file(chip8_t *chip8, const char state_name[]) {
+    const size_t capacity = chip8_state_size(chip8);
+    uint8_t *buffer = malloc(capacity);
+    FILE *state = fopen(state_name, "rb");
+    if (state == NULL || buffer == NULL) {
+        printf("Could not open save state: %s\n", state_name);
+        if (state != NULL) {
+            fclose(state);
+        }
+        free(buffer);
+        return false;
+    }
+    const size_t size = fread(buffer, 1, capacity, state);
+    const bool longer = fgetc(state) != EOF;
+    fclose(state);
+    if (longer) {
+        printf("Save state is larger than this instance's: %s\n", state_name);
+    }
+    const bool loaded = !longer && chip8_load_state(chip8, buffer, size);
+    free(buffer);
+    return loaded;
+}
+
+// Framebuffer of window_height rows of CHIP8_ROW_WORDS words, bit 63 of a row's first word is its leftmost pixel
+const uint64_t *chip8_framebuffer(const chip8_t *chip8) {
+    return &chip8->display[0][0][0];
+}
+
+// FNV-1a hash of the display, registers, index pointer and program counter
+uint64_t chip8_state_hash(const chip8_t *chip8) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    const uint8_t *parts[] = {(const uint8_t *)chip8->display, chip8->V, (const uint8_t *)&chip8->I, (const uint8_t *)&chip8->PC};
+    const size_t sizes[] = {sizeof chip8->display, sizeof chip8->V, sizeof chip8->I, sizeof chip8->PC};
+    for (size_t part = 0; part < sizeof parts / sizeof parts[0]; part++) {
+        for (size_t i = 0; i < sizes[part]; i++) {
+            hash = (hash ^ parts[part][i]) * 0x100000001B3ull;
+        }
+    }
+    return hash;
+}
+
+// One XXH64 round: fold an input word into an accumulator
+static inline uint64_t xxh64_round(uint64_t accumulator, uint64_t input) {
+    accumulator += input * 0xC2B2AE3D27D4EB4Full;
+    accumulator = accumulator << 31 | accumulator >> 33;
+    return accumulator * 0x9E3779B185EBCA87ull;
+}
+
+// XXH64 of the display words, seeded with the resolution. The display is a whole number of 32-byte stripes,
+// and words are hashed by value, so the hash is the same on any byte order
+uint64_t chip8_display_hash(const chip8_t *chip8) {
+    const uint64_t prime1 = 0x9E3779B185EBCA87ull, prime2 = 0xC2B2AE3D27D4EB4Full, prime4 = 0x85EBCA77C2B2AE63ull;
+    const uint64_t seed = chip8->hires;
+    uint64_t lanes[4] = {seed + prime1 + prime2, seed + prime2, seed, seed - prime1};
+    const uint64_t *words = &chip8->display[0][0][0];
+    const size_t count = sizeof chip8->display / sizeof *words;
+    for (size_t i = 0; i < count; i += 4) {
+        for (size_t lane = 0; lane < 4; lane++) {
+            lanes[lane] = xxh64_round(lanes[lane], words[i + lane]);
+        }
+    }
+    uint64_t hash = (lanes[0] << 1 | lanes[0] >> 63) + (lanes[1] << 7 | lanes[1] >> 57) + (lanes[2] << 12 | lanes[2] >> 52) + (lanes[3] << 18 | lanes[3] >> 46);
+    for (size_t lane = 0; lane < 4; lane++) {
+        hash = (hash ^ xxh64_round(0, lanes[lane])) * prime1 + prime4;
+    }
+    hash += sizeof chip8->display;
+    hash ^= hash >> 33;                                                                     // Avalanche
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= 0x165667B19E3779F9ull;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Breakpoint table, allocated on first use
+static struct chip8_breakpoints *get_breakpoints(chip8_t *chip8) {
+    if (chip8->breakpoints == NULL) {
+        chip8->breakpoints = calloc(1, sizeof *chip8->breakpoints);
+    }
+    return chip8->breakpoints;
+}
+
+// Set or clear the bits of length addresses from address, wrapping at the end of memory
+static void mark_range(uint64_t *bitmap, uint16_t address, uint32_t length, uint16_t mask, bool enabled) {
+    for (uint32_t i = 0; i < length; i++) {
+        const uint16_t bit = (address + i) & mask;
+        if (enabled) {
+            bitmap[bit >> 6] |= 1ull << (bit & 63);
+        }
+        else {
+            bitmap[bit >> 6] &= ~(1ull << (bit & 63));
+        }
+    }
+}
+
+// Recount whether anything is armed, so chip8_step can go back to the fast loops
+static void update_armed(struct chip8_breakpoints *breakpoints) {
+    uint64_t any = breakpoints->registers;
+    for (size_t i = 0; i < sizeof breakpoints->pc / sizeof breakpoints->pc[0]; i++) {
+        any |= breakpoints->pc[i] | breakpoints->read[i] | breakpoints->write[i];
+    }
+    breakpoints->armed = any != 0;
+}
+
+// Stop before the instruction at address runs
+bool chip8_set_breakpoint(chip8_t *chip8, uint16_t address, bool enabled) {
+    struct chip8_breakpoints *breakpoints = get_breakpoints(chip8);
+    if (breakpoints == NULL) {
+        return false;
+    }
+    mark_range(breakpoints->pc, address, 1, chip8->memory_size - 1, enabled);
+    update_armed(breakpoints);
+    return true;
+}
+
+// Stop before an instruction reads or writes any of length bytes from address
+bool chip8_set_watchpoint(chip8_t *chip8, uint16_t address, uint16_t length, bool read, bool write, bool enabled) {
+    struct chip8_breakpoints *breakpoints = get_breakpoints(chip8);
+    if (breakpoints == NULL) {
+        return false;
+    }
+    if (read) {
+        mark_range(breakpoints->read, address, length, chip8->memory_size - 1, enabled);
+    }
+    if (write) {
+        mark_range(breakpoints->write, address, length, chip8->memory_size - 1, enabled);
+    }
+    update_armed(breakpoints);
+    return true;
+}
+
+// Stop after an instruction changes V[reg], or I when reg is 16
+bool chip8_watch_register(chip8_t *chip8, uint8_t reg, bool enabled) {
+    struct chip8_breakpoints *breakpoints = get_breakpoints(chip8);
+    if (breakpoints == NULL || reg > 16) {
+        return false;
+    }
+    breakpoints->registers = enabled ? breakpoints->registers | 1u << reg : breakpoints->registers & ~(1u << reg);
+    update_armed(breakpoints);
+    return true;
+}
+
+// Disarm every breakpoint and watchpoint
+void chip8_clear_breakpoints(chip8_t *chip8) {
+    if (chip8->breakpoints != NULL) {
+        memset(chip8->breakpoints, 0, sizeof *chip8->breakpoints);
+    }
+}
+
+// Arm a breakpoint from a command line option
+bool chip8_parse_breakpoint(chip8_t *chip8, const char option[], const char value[]) {
+    char *end;
+    if (strcmp(option, "--watch-reg") == 0) {
+        if (strcmp(value, "I") == 0 || strcmp(value, "i") == 0) {
+            return chip8_watch_register(chip8, 16, true);
+        }
+        if ((value[0] != 'V' && value[0] != 'v') || value[1] == '\0') {
+            return false;
+        }
+        const unsigned long reg = strtoul(&value[1], &end, 16);
+        return *end == '\0' && reg < 16 && chip8_watch_register(chip8, reg, true);
+    }
+    const unsigned long address = strtoul(value, &end, 16);
+    unsigned long length = 1;
+    if (*end == ':') {
+        length = strtoul(end + 1, &end, 0);
+    }
+    if (*end != '\0' || end == value || address >= chip8->memory_size || length == 0 || length > chip8->memory_size) {
+        return false;
+    }
+    if (strcmp(option, "--break") == 0) {
+        return length == 1 && chip8_set_breakpoint(chip8, address, true);
+    }
+    if (strcmp(option, "--watch-read") == 0) {
+        return chip8_set_watchpoint(chip8, address, length, true, false, true);
+    }
+    if (strcmp(option, "--watch-write") == 0) {
+        return chip8_set_watchpoint(chip8, address, length, false, true, true);
+    }
+    return false;
+}
+
+// Human readable description of why chip8_step stopped
+const char *chip8_break_name(chip8_break_t reason) {
+    switch (reason) {
+        case CHIP8_BREAK_PC:
+            return "breakpoint";
+        case CHIP8_BREAK_READ:
+            return "read watchpoint";
+        case CHIP8_BREAK_WRITE:
+            return "write watchpoint";
+        case CHIP8_BREAK_REGISTER:
+            return "register watch";
+        default:
+            return "none";
+    }
+}
+
+// Name of an opcode in profile reports
+static const char *op_name(uint8_t op) {
+#define NAME(name) [OP_##name] = #name,
+    static const char *const names[OP_COUNT] = {
+        [OP_DECODE] = "decode",
+        [OP_INVALID] = "invalid",
+        OPCODES(NAME)
+    };
+#undef NAME
+    return names[op];
+}
+
+// One row of a profile report
+typedef struct {
+    uint64_t count;
+    uint64_t time;
+    uint16_t index;         // Opcode or address the row is about
+} profile_row_t;
+
+// Most time first
+static int compare_rows(const void *a, const void *b) {
+    const profile_row_t *x = a;
+    const profile_row_t *y = b;
+    return (x->time < y->time) - (x->time > y->time);
+}
+
+#define PROFILE_TOP_ADDRESSES 20
+
+// Print the opcodes and addresses that took the most time
+bool chip8_profile_report(const chip8_t *chip8, FILE *out) {
+    if (!CHIP8_PROFILE) {
+        printf("Profiling is not built in, rebuild with make PROFILE=1\n");
+        return false;
+    }
+    const struct chip8_profile *profile = chip8->profile;
+    if (profile == NULL) {
+        return false;
+    }
+    profile_row_t *rows = malloc(chip8->memory_size * sizeof *rows);                        // At least OP_COUNT rows
+    if (rows == NULL) {
+        return false;
+    }
+    uint64_t total_count = 0;
+    uint64_t total_time = 0;
+    uint32_t count = 0;
+    for (uint16_t op = 0; op < OP_COUNT; op++) {
+        if (profile->op_count[op] != 0) {
+            rows[count++] = (profile_row_t) {.count = profile->op_count[op], .time = profile->op_time[op], .index = op};
+            total_count += profile->op_count[op];
+            total_time += profile->op_time[op];
+        }
+    }
+    qsort(rows, count, sizeof rows[0], compare_rows);
+    fprintf(out, "%-8s %14s %7s %16s %7s %9s\n", "opcode", "count", "count%", "time", "time%", "time/op");
+    for (uint32_t i = 0; i < count; i++) {
+        fprintf(out, "%-8s %14llu %6.2f%% %16llu %6.2f%% %9.1f\n", op_name(rows[i].index), (unsigned long long)rows[i].count, rows[i].count * 100.0 / total_count,
+                (unsigned long long)rows[i].time, total_time ? rows[i].time * 100.0 / total_time : 0.0, (double)rows[i].time / rows[i].count);
+    }
+    count = 0;
+    for (uint32_t address = 0; address < chip8->memory_size; address++) {
+        if (profile->pc_count[address] != 0) {
+            rows[count++] = (profile_row_t) {.count = profile->pc_count[address], .time = profile->pc_time[address], .index = address};
+        }
+    }
+    qsort(rows, count, sizeof rows[0], compare_rows);
+    fprintf(out, "\n%-8s %-8s %14s %7s %16s %7s\n", "address", "opcode", "count", "count%", "time", "time%");
+    for (uint32_t i = 0; i < count && i < PROFILE_TOP_ADDRESSES; i++) {
+        fprintf(out, "0x%03X    %-8s %14llu %6.2f%% %16llu %6.2f%%\n", rows[i].index, op_name(profile->pc_op[rows[i].index]), (unsigned long long)rows[i].count,
+                rows[i].count * 100.0 / total_count, (unsigned long long)rows[i].time, total_time ? rows[i].time * 100.0 / total_time : 0.0);
+    }
+    free(rows);
+    return true;
+}
+
+// Write the time spent at every address as folded stacks
+bool chip8_profile_write_folded(const chip8_t *chip8, const char path[]) {
+    if (!CHIP8_PROFILE) {
+        printf("Profiling is not built in, rebuild with make PROFILE=1\n");
+        return false;
+    }
+    const struct chip8_profile *profile = chip8->profile;
+    if (profile == NULL) {
+        return false;
+    }
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Could not create profile: %s\n", path);
+        return false;
+    }
+    for (uint32_t address = 0; address < chip8->memory_size; address++) {
+        if (profile->pc_count[address] != 0) {
+            fprintf(file, "%s;0x%03X %llu\n", op_name(profile->pc_op[address]), address, (unsigned long long)profile->pc_time[address]);
+        }
+    }
+    const bool written = fclose(file) == 0;
+    if (!written) {
+        printf("Could not write profile: %s\n", path);
+    }
+    return written;
+}
+
+// Press or release one of the 16 keypad keys
+void chip8_set_key(chip8_t *chip8, uint8_t key, bool pressed) {
+    chip8->keypad[key & 0xF] = pressed;
+    chip8->blocked = false;                                                                 // Until 0xFX0A looks at the keypad again
 }
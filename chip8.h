@@ -0,0 +1,262 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+    uint16_t opcode;        // Opcode of the instruction
+    uint16_t NNN;           // Lowest 12 bits of the instruction
+    uint8_t NN;             // Lowest 8 bits of the instruction
+    uint8_t N;              // Lowest 4 bits of the instruction
+    uint8_t X;              // Lower 4 bits of the high byte of the instruction
+    uint8_t Y;              // Upper 4 bits of the low byte of the instruction
+} instruction_t;
+
+// Interpreter loops chip8_step can run
+typedef enum {
+    ENGINE_CACHED,          // Indirect call through the decode cache for each instruction
+    ENGINE_THREADED,        // Computed goto between handler bodies (GCC/Clang, otherwise same as cached)
+    ENGINE_BLOCK,           // Straight-line runs compiled to fused superinstructions, for uncapped batch runs
+    ENGINE_COUNT
+} engine_t;
+
+// Engine picked by chip8_reset, override with -DCHIP8_ENGINE=...
+#ifndef CHIP8_ENGINE
+#define CHIP8_ENGINE ENGINE_THREADED
+#endif
+
+// Build with -DCHIP8_PROFILE=1 to count executions and time of every opcode and address. Every engine
+// then runs through the cached loop, so each instruction passes the one counting point
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 0
+#endif
+
+// Platforms chip8->mode selects, each decoding the opcodes of the ones before it plus its own
+enum {
+    MODE_CHIP8,             // The original chip-8
+    MODE_SUPERCHIP,         // 128x64 high resolution, scrolling, 16x16 sprites and flag registers
+    MODE_XOCHIP,            // SuperChip plus 64KB memory, two bitplanes and audio patterns
+    MODE_COUNT
+};
+
+// Quirk profiles. Each decodes the opcodes that differ between interpreters to their own handler variants,
+// so the interpreter loops never test a quirk
+typedef enum {
+    QUIRKS_CHIP8,           // 8XY1-8XY3 reset VF, 8XY6/8XYE shift VY, FX55/FX65 advance I, BNNN adds V0, sprites clip, waits for vblank
+    QUIRKS_SCHIP_LEGACY,    // SuperChip 1.1: VF kept, VX shifted in place, I kept, BXNN adds VX, sprites clip, waits for vblank
+    QUIRKS_SCHIP_MODERN,    // Later SuperChip interpreters: as legacy without the vblank wait
+    QUIRKS_XOCHIP,          // As the original chip-8 but VF kept, sprites wrap and no vblank wait
+    QUIRKS_COUNT
+} quirks_t;
+
+// Words in a display row, enough for the 128 pixels of high resolution
+#define CHIP8_ROW_WORDS 2
+
+// XO-Chip bitplanes, each pixel is a two bit color with plane 0 as its low bit
+#define CHIP8_PLANES 2
+
+// Memory of an instance from chip8_create, and of one that can run any XO-Chip ROM
+#define CHIP8_MEMORY_SIZE 4096
+#define CHIP8_XO_MEMORY_SIZE 65536
+
+typedef struct chip8 chip8_t;
+
+// Why the last chip8_step stopped before its budget ran out, apart from display_wait
+typedef enum {
+    CHIP8_BREAK_NONE,
+    CHIP8_BREAK_PC,         // The instruction at break_address is about to run
+    CHIP8_BREAK_READ,       // The instruction at PC is about to read watched memory at break_address
+    CHIP8_BREAK_WRITE,      // The instruction at PC is about to write watched memory at break_address
+    CHIP8_BREAK_REGISTER,   // The instruction before PC changed watched register break_address (16 is I)
+} chip8_break_t;
+
+// Executes one decoded instruction. PC already points past it
+typedef void (*handler_t)(chip8_t *chip8, const instruction_t *instruction);
+
+typedef struct {
+    handler_t handler;          // Handler for the opcode, or the decoder if the entry is stale
+    instruction_t instruction;  // Fields extracted when the entry was decoded
+    uint8_t op;                 // Index of the handler, used by threaded dispatch
+} decoded_t;
+
+struct chip8 {
+    uint32_t window_width;  // Pixel width of the current resolution, 64 or 128 in high resolution
+    uint32_t window_height; // Pixel height of the current resolution, 32 or 64 in high resolution
+    bool hires;             // SuperChip 0x00FF high resolution is on
+    uint32_t emulation_rate; // number of instructions to read per second
+    uint32_t cycle_credit;  // Remainder of emulation_rate / 60 carried to the next frame
+    bool display_wait;      // 0xDXYN ends the frame, as the original interpreter waited for vblank
+    uint32_t memory_size;   // Bytes of memory, a power of two picked at chip8_create_with_memory
+    uint8_t *memory;        // Chip-8 ram, allocated with the instance right after the cache
+    uint64_t display[64][CHIP8_ROW_WORDS][CHIP8_PLANES]; // Rows of 128 pixels, the same word of both planes side by side. Bit 63 of word 0 is the leftmost. Low resolution uses the top-left 64x32
+    uint8_t planes;         // XO-Chip 0xFN01 mask of the planes drawn, cleared and scrolled, plane 0 only until then
+    uint8_t V[16];          // Registers
+    uint16_t I;             // Index Pointer
+    uint16_t PC;            // Program Counter
+    uint16_t stack[16];     // Stack
+    uint16_t *SP;           // Stack Pointer
+    uint8_t delay_timer;    // Delay Timer
+    uint8_t sound_timer;    // Sound Timer
+    uint8_t flags[16];      // SuperChip 0xFX75/0xFX85 flag registers, kept across reset like the HP48's
+    uint8_t audio_pattern[16]; // XO-Chip 0xF002 waveform, 128 one-bit samples played while the sound timer runs
+    bool audio_pattern_set; // 0xF002 has run since reset, until then the buzzer is a plain square wave
+    uint8_t pitch;          // XO-Chip 0xFX3A pattern rate, 4000 * 2^((pitch - 64) / 48) samples per second
+    bool keypad[16];        // Keypad for button input
+    uint8_t wait_key;       // Key 0xFX0A saw pressed and is waiting on to be released, 0xFF if none
+    bool blocked;           // 0xFX0A is waiting on the keypad, with skip_idle chip8_step spends its budget there at once
+    uint64_t seed;          // Seed the 0xCXNN generator restarts from at every reset
+    uint64_t rng;           // xorshift64* state of the 0xCXNN generator
+    uint8_t state;          // State = Active, Paused, Quit
+    bool debug_state;       // Report invalid opcodes as they run
+    uint8_t mode;           // Platform whose opcodes are decoded, MODE_CHIP8/SUPERCHIP/XOCHIP. Change it with chip8_set_mode
+    quirks_t quirks;        // Quirk profile the opcodes decode to, the mode's own unless changed with chip8_set_quirks
+    uint64_t dirty_rows;    // Bit n is set when row n may have changed, the frontend clears it once presented
+    engine_t engine;        // Interpreter loop used by chip8_step
+    bool skip_idle;         // chip8_step fast-forwards loops that only poll the delay timer or keypad (see chip8_step)
+    bool halted;            // The program is spinning in a loop that reads no input and never changes anything, it can never leave
+    uint32_t idle_reject;   // Loop start every pass of which runs an opcode that can change something, UINT32_MAX if none
+    struct block_cache *blocks; // Compiled blocks, allocated the first time ENGINE_BLOCK runs
+    struct chip8_profile *profile; // Execution counters, allocated by the first instruction of a CHIP8_PROFILE build
+    struct chip8_trace *trace; // Ring every executed instruction is appended to, NULL when not tracing (see trace.h)
+    struct chip8_breakpoints *breakpoints; // Armed breakpoints and watchpoints, allocated by the first one set
+    struct chip8_snapshot *snapshot; // Machine chip8_restore_snapshot returns to, NULL until chip8_take_snapshot
+    uint64_t written_pages[CHIP8_XO_MEMORY_SIZE / 64 / 64]; // Bit n % 64 of word n / 64: 64-byte page n of memory was written since the snapshot
+    chip8_break_t break_reason; // Why the last chip8_step stopped early, CHIP8_BREAK_NONE if it did not
+    uint16_t break_address; // Breakpoint, memory address or register that stopped it
+    decoded_t cache[];      // Pre-decoded instruction starting at each address of memory
+};
+
+// Allocate an instance with CHIP8_MEMORY_SIZE bytes of memory and the default configuration, reset to power-on state with no ROM loaded
+chip8_t *chip8_create(void);
+
+// Allocate an instance with memory_size bytes of memory, a power of two from CHIP8_MEMORY_SIZE to CHIP8_XO_MEMORY_SIZE.
+// XO-Chip ROMs need CHIP8_XO_MEMORY_SIZE, the 4KB of chip8_create keeps instances running one of the others small
+chip8_t *chip8_create_with_memory(uint32_t memory_size);
+
+// Free an instance created with chip8_create
+void chip8_destroy(chip8_t *chip8);
+
+// Reset to power-on state: clears memory, registers and display, reloads the font and reseeds 0xCXNN.
+// Configuration (emulation_rate, display_wait, debug_state, mode, engine, skip_idle, seed) is kept
+void chip8_reset(chip8_t *chip8);
+
+// Set the seed 0xCXNN restarts from at reset and restart its sequence now
+void chip8_seed(chip8_t *chip8, uint64_t seed);
+
+// Reset and copy a ROM image to 0x200. Fails if the ROM does not fit in memory
+bool chip8_load_rom(chip8_t *chip8, const uint8_t *rom, size_t rom_size);
+
+// Reset and load a ROM from disk
+bool chip8_load_rom_file(chip8_t *chip8, const char rom_name[]);
+
+// Remember the machine as it is now, normally right after loading a ROM, for chip8_restore_snapshot.
+// Like chip8_reset, the snapshot leaves out the configuration and the SuperChip flags
+bool chip8_take_snapshot(chip8_t *chip8);
+
+// Return to the snapshot in place of a reset and reload. Only the 64-byte pages of memory written since are
+// copied back, and instructions decoded from the others are kept. Fails if no snapshot was taken
+bool chip8_restore_snapshot(chip8_t *chip8);
+
+// Drop every pre-decoded instruction. Needed after writing memory directly, and counts all of memory as written
+void chip8_invalidate_cache(chip8_t *chip8);
+
+// Emulate one instruction, leaving the decoded instruction in *instruction
+void emulate_instruction(chip8_t *chip8, instruction_t *instruction);
+
+// Emulate up to cycles instructions, stopping early after a draw (0xDXYN) if display_wait is set. Returns the number executed.
+// With skip_idle, a loop that comes back to where it started with V and I unchanged, having only read the delay timer
+// or keypad, tested registers and jumped, repeats itself until the step ends: its whole passes are counted without running them.
+// If the loop reads neither, halted is set. An 0xFX0A still waiting for a key likewise uses up the rest of the budget
+uint32_t chip8_step(chip8_t *chip8, uint32_t cycles);
+
+// Human readable name of a dispatch engine
+const char *chip8_engine_name(engine_t engine);
+
+// Switch platforms, dropping decoded instructions since opcodes decode differently.
+// Also picks the platform's quirk profile (SuperChip gets QUIRKS_SCHIP_MODERN). Going back to the original chip-8 leaves high resolution
+void chip8_set_mode(chip8_t *chip8, uint8_t mode);
+
+// Human readable name of a platform
+const char *chip8_mode_name(uint8_t mode);
+
+// Switch quirk profiles, dropping decoded instructions. Sets display_wait to the profile's
+void chip8_set_quirks(chip8_t *chip8, quirks_t quirks);
+
+// Human readable name of a quirk profile
+const char *chip8_quirks_name(quirks_t quirks);
+
+// Instructions to run this 60Hz frame, spreading emulation_rate evenly over every second
+uint32_t chip8_frame_cycles(chip8_t *chip8);
+
+// Decrement the delay and sound timers, called at 60Hz
+void chip8_update_timers(chip8_t *chip8);
+
+// Framebuffer of window_height rows of CHIP8_ROW_WORDS words, each followed by the same word of plane 1.
+// Bit 63 of a row's first word is its leftmost pixel
+const uint64_t *chip8_framebuffer(const chip8_t *chip8);
+
+// Color of the pixel at x, y: bit n is set when it is lit in plane n
+static inline uint8_t chip8_pixel(const chip8_t *chip8, uint32_t x, uint32_t y) {
+    const uint64_t *word = chip8->display[y][x >> 6];
+    return ((word[0] >> (63 - (x & 63))) & 1) | ((word[1] >> (63 - (x & 63))) & 1) << 1;
+}
+
+// Version written into save states, bumped whenever the layout changes
+#define CHIP8_STATE_VERSION 5
+
+// Bytes a save state of this instance takes
+size_t chip8_state_size(const chip8_t *chip8);
+
+// Write memory, registers, flags, stack, timers, keypad, random state, audio pattern and display to buffer in the save state format.
+// Returns the bytes written, 0 if capacity is smaller than chip8_state_size
+size_t chip8_save_state(const chip8_t *chip8, uint8_t *buffer, size_t capacity);
+
+// Restore a save state. Fails without changing anything if it is not a valid state of this version.
+// Configuration (emulation_rate, display_wait, debug_state, mode, engine, skip_idle, seed) is kept
+bool chip8_load_state(chip8_t *chip8, const uint8_t *buffer, size_t size);
+
+// Write a save state to disk
+bool chip8_save_state_file(const chip8_t *chip8, const char state_name[]);
+
+// Restore a save state from disk
+bool chip8_load_state_file(chip8_t *chip8, const char state_name[]);
+
+// FNV-1a hash of the display, registers, index pointer and program counter, for comparing runs
+uint64_t chip8_state_hash(const chip8_t *chip8);
+
+// XXH64 of the display and its resolution alone, cheap enough to take every frame for golden comparisons
+uint64_t chip8_display_hash(const chip8_t *chip8);
+
+// Stop before the instruction at address runs. Returns false if the breakpoint table could not be allocated
+bool chip8_set_breakpoint(chip8_t *chip8, uint16_t address, bool enabled);
+
+// Stop before an instruction reads (0xDXYN, 0xFX65, 0x5XY3) or writes (0xFX33, 0xFX55, 0x5XY2) any of length bytes from address
+bool chip8_set_watchpoint(chip8_t *chip8, uint16_t address, uint16_t length, bool read, bool write, bool enabled);
+
+// Stop after an instruction changes V[reg], or I when reg is 16
+bool chip8_watch_register(chip8_t *chip8, uint8_t reg, bool enabled);
+
+// Disarm every breakpoint and watchpoint
+void chip8_clear_breakpoints(chip8_t *chip8);
+
+// Arm a breakpoint from a command line option: --break ADDR, --watch-read ADDR[:LENGTH], --watch-write ADDR[:LENGTH]
+// or --watch-reg VX|I, addresses in hex. Returns false if option is not one of these or value does not parse
+bool chip8_parse_breakpoint(chip8_t *chip8, const char option[], const char value[]);
+
+// Human readable description of why chip8_step stopped
+const char *chip8_break_name(chip8_break_t reason);
+
+// Print the opcodes and addresses that took the most time, most expensive first.
+// Fails if built without CHIP8_PROFILE or before anything ran
+bool chip8_profile_report(const chip8_t *chip8, FILE *out);
+
+// Write the time spent at every address as folded stacks ("opcode;address time" per line) for flamegraph.pl
+bool chip8_profile_write_folded(const chip8_t *chip8, const char path[]);
+
+// Press or release one of the 16 keypad keys
+void chip8_set_key(chip8_t *chip8, uint8_t key, bool pressed);
+
+#endif
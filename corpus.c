@@ -0,0 +1,391 @@
+#define _POSIX_C_SOURCE 200809L                                                        // fileno, stat and mmap
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+#include "corpus.h"
+
+// Little-endian packed corpus layout:
+//   "C8PK", u16 version, u16 reserved, u32 ROM count
+//   then per ROM u16 name length, u8 mode, u8 quirk profile, u32 size, the name and the image
+#define PACK_VERSION 1
+#define PACK_HEADER 12
+#define PACK_ENTRY 8
+
+// Store value as size little-endian bytes
+static uint8_t *put_le(uint8_t *out, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        *out++ = value >> (8 * i);
+    }
+    return out;
+}
+
+// Read size little-endian bytes
+static uint64_t get_le(const uint8_t *in, size_t size) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+// Rotate a 32-bit word left
+static inline uint32_t rotate_left(uint32_t value, uint32_t bits) {
+    return value << bits | value >> (32 - bits);
+}
+
+// SHA-1 of one 64-byte block folded into state
+static void sha1_block(uint32_t state[5], const uint8_t block[64]) {
+    uint32_t w[80];
+    for (uint32_t i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[4 * i] << 24 | block[4 * i + 1] << 16 | block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (uint32_t i = 16; i < 80; i++) {
+        w[i] = rotate_left(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (uint32_t i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        const uint32_t t = rotate_left(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotate_left(b, 30);
+        b = a;
+        a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+// SHA-1 of size bytes of data
+void chip8_sha1(const uint8_t *data, size_t size, uint8_t digest[20]) {
+    uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    size_t offset = 0;
+    for (; offset + 64 <= size; offset += 64) {
+        sha1_block(state, &data[offset]);
+    }
+    uint8_t tail[128] = {0};                                                                // The rest, the 0x80 marker and the bit length
+    const size_t rest = size - offset;
+    memcpy(tail, &data[offset], rest);
+    tail[rest] = 0x80;
+    const size_t tail_size = rest < 56 ? 64 : 128;
+    const uint64_t bits = (uint64_t)size * 8;
+    for (uint32_t i = 0; i < 8; i++) {
+        tail[tail_size - 1 - i] = bits >> (8 * i);
+    }
+    for (size_t i = 0; i < tail_size; i += 64) {
+        sha1_block(state, &tail[i]);
+    }
+    for (uint32_t i = 0; i < 20; i++) {
+        digest[i] = state[i / 4] >> (24 - 8 * (i % 4));
+    }
+}
+
+// Guess the platform a ROM was written for from the opcodes it contains. Data is scanned too,
+// so this errs towards the newer platform, which still runs the older one's opcodes
+static uint8_t detect_mode(const uint8_t *data, size_t size) {
+    if (size > CHIP8_MEMORY_SIZE - 0x200) {
+        return MODE_XOCHIP;                                                                 // Only fits in XO-Chip memory
+    }
+    uint8_t mode = MODE_CHIP8;
+    for (size_t i = 0; i + 1 < size; i += 2) {
+        const uint16_t opcode = data[i] << 8 | data[i + 1];
+        if (opcode == 0xF000 || opcode == 0xF002 || (opcode & 0xF0FF) == 0xF001 || (opcode & 0xF0FF) == 0xF03A) {
+            return MODE_XOCHIP;                                                             // F000 NNNN, audio and plane selection
+        }
+        if (opcode == 0x00FE || opcode == 0x00FF || opcode == 0x00FB || opcode == 0x00FC || opcode == 0x00FD ||
+            (opcode & 0xF0FF) == 0xF030 || (opcode & 0xF0FF) == 0xF075 || (opcode & 0xF0FF) == 0xF085) {
+            mode = MODE_SUPERCHIP;
+        }
+    }
+    return mode;
+}
+
+// Quirk profile a platform starts in, as chip8_set_mode picks it
+static quirks_t mode_quirks(uint8_t mode) {
+    switch (mode) {
+        case MODE_SUPERCHIP:
+            return QUIRKS_SCHIP_MODERN;
+        case MODE_XOCHIP:
+            return QUIRKS_XOCHIP;
+        default:
+            return QUIRKS_CHIP8;
+    }
+}
+
+// Copy of a string in a new buffer
+static char *copy_string(const char *string, size_t length) {
+    char *copy = malloc(length + 1);
+    if (copy != NULL) {
+        memcpy(copy, string, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+// Append a ROM to the index, hashing it. mode 0xFF detects the platform and quirk profile
+static bool add_rom(chip8_corpus_t *corpus, const char *name, size_t name_length, const uint8_t *data, size_t size, uint8_t mode, uint8_t quirks) {
+    if (corpus->count == corpus->capacity) {
+        const uint32_t capacity = corpus->capacity != 0 ? corpus->capacity * 2 : 64;
+        chip8_corpus_rom_t *roms = realloc(corpus->roms, capacity * sizeof *roms);
+        if (roms == NULL) {
+            return false;
+        }
+        corpus->roms = roms;
+        corpus->capacity = capacity;
+    }
+    chip8_corpus_rom_t *rom = &corpus->roms[corpus->count];
+    rom->name = copy_string(name, name_length);
+    if (rom->name == NULL) {
+        return false;
+    }
+    rom->data = data;
+    rom->size = size;
+    rom->mode = mode < MODE_COUNT ? mode : detect_mode(data, size);
+    rom->quirks = quirks < QUIRKS_COUNT ? quirks : mode_quirks(rom->mode);
+    chip8_sha1(data, size, rom->sha1);
+    corpus->count++;
+    return true;
+}
+
+// Map a whole file read-only. Empty files map to a static empty image
+static const uint8_t *map_file(chip8_corpus_t *corpus, const char path[], size_t *size) {
+    static const uint8_t empty[1];
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("Could not open rom: %s\n", path);
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fileno(file), &info) != 0 || !S_ISREG(info.st_mode)) {
+        printf("Not a rom file: %s\n", path);
+        fclose(file);
+        return NULL;
+    }
+    *size = info.st_size;
+    if (*size == 0) {
+        fclose(file);
+        return empty;
+    }
+    if (corpus->mapping_count == corpus->mapping_capacity) {
+        const uint32_t capacity = corpus->mapping_capacity != 0 ? corpus->mapping_capacity * 2 : 64;
+        chip8_corpus_mapping_t *mappings = realloc(corpus->mappings, capacity * sizeof *mappings);
+        if (mappings == NULL) {
+            fclose(file);
+            return NULL;
+        }
+        corpus->mappings = mappings;
+        corpus->mapping_capacity = capacity;
+    }
+#if defined(_WIN32)
+    void *base = malloc(*size);                                                             // No mmap, read it once instead
+    if (base != NULL && fread(base, 1, *size, file) != *size) {
+        free(base);
+        base = NULL;
+    }
+#else
+    void *base = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (base == MAP_FAILED) {
+        base = NULL;
+    }
+#endif
+    fclose(file);                                                                           // The mapping outlives the descriptor
+    if (base == NULL) {
+        printf("Could not map rom: %s\n", path);
+        return NULL;
+    }
+    corpus->mappings[corpus->mapping_count++] = (chip8_corpus_mapping_t) {.base = base, .size = *size};
+    return base;
+}
+
+// Index every ROM of a mapped packed corpus
+static bool add_pack(chip8_corpus_t *corpus, const char path[], const uint8_t *data, size_t size) {
+    if (size < PACK_HEADER || get_le(&data[4], 2) != PACK_VERSION) {
+        printf("Unsupported packed corpus: %s\n", path);
+        return false;
+    }
+    const uint32_t count = get_le(&data[8], 4);
+    size_t offset = PACK_HEADER;
+    for (uint32_t i = 0; i < count; i++) {
+        if (size - offset < PACK_ENTRY) {
+            printf("Packed corpus is truncated: %s\n", path);
+            return false;
+        }
+        const size_t name_length = get_le(&data[offset], 2);
+        const uint8_t mode = data[offset + 2];
+        const uint8_t quirks = data[offset + 3];
+        const size_t rom_size = get_le(&data[offset + 4], 4);
+        offset += PACK_ENTRY;
+        if (size - offset < name_length || size - offset - name_length < rom_size) {
+            printf("Packed corpus is truncated: %s\n", path);
+            return false;
+        }
+        if (!add_rom(corpus, (const char *)&data[offset], name_length, &data[offset + name_length], rom_size, mode, quirks)) {
+            return false;
+        }
+        offset += name_length + rom_size;
+    }
+    return true;
+}
+
+// Order directory entries by name
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Add every file of a directory, skipping hidden ones
+static bool add_directory(chip8_corpus_t *corpus, const char path[]) {
+    DIR *directory = opendir(path);
+    if (directory == NULL) {
+        printf("Could not open directory: %s\n", path);
+        return false;
+    }
+    char **names = NULL;
+    uint32_t count = 0, capacity = 0;
+    bool added = true;
+    for (struct dirent *entry; added && (entry = readdir(directory)) != NULL;) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity != 0 ? capacity * 2 : 64;
+            char **grown = realloc(names, capacity * sizeof *names);
+            added = grown != NULL;
+            names = added ? grown : names;
+        }
+        const size_t length = strlen(path) + 1 + strlen(entry->d_name);
+        if (added && (names[count] = malloc(length + 1)) != NULL) {
+            snprintf(names[count++], length + 1, "%s/%s", path, entry->d_name);
+        }
+    }
+    closedir(directory);
+    qsort(names, count, sizeof *names, compare_names);                                      // readdir order depends on the file system
+    for (uint32_t i = 0; i < count; i++) {
+        struct stat info;
+        if (added && stat(names[i], &info) == 0 && S_ISREG(info.st_mode)) {                 // Subdirectories are not searched
+            added = chip8_corpus_add(corpus, names[i]);
+        }
+        free(names[i]);
+    }
+    free(names);
+    return added;
+}
+
+// Allocate an empty corpus
+chip8_corpus_t *chip8_corpus_create(void) {
+    return calloc(1, sizeof(chip8_corpus_t));
+}
+
+// Unmap every file and free the index
+void chip8_corpus_destroy(chip8_corpus_t *corpus) {
+    if (corpus == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < corpus->count; i++) {
+        free(corpus->roms[i].name);
+    }
+    for (uint32_t i = 0; i < corpus->mapping_count; i++) {
+#if defined(_WIN32)
+        free(corpus->mappings[i].base);
+#else
+        munmap(corpus->mappings[i].base, corpus->mappings[i].size);
+#endif
+    }
+    free(corpus->roms);
+    free(corpus->mappings);
+    free(corpus);
+}
+
+// Map path and index the ROMs in it
+bool chip8_corpus_add(chip8_corpus_t *corpus, const char path[]) {
+    struct stat info;
+    if (stat(path, &info) == 0 && S_ISDIR(info.st_mode)) {
+        return add_directory(corpus, path);
+    }
+    size_t size;
+    const uint8_t *data = map_file(corpus, path, &size);
+    if (data == NULL) {
+        return false;
+    }
+    if (size >= 4 && memcmp(data, "C8PK", 4) == 0) {
+        return add_pack(corpus, path, data, size);
+    }
+    return add_rom(corpus, path, strlen(path), data, size, 0xFF, 0xFF);
+}
+
+// Write every ROM of the corpus to path as one packed corpus file
+bool chip8_corpus_pack(const chip8_corpus_t *corpus, const char path[]) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("Could not create packed corpus: %s\n", path);
+        return false;
+    }
+    uint8_t header[PACK_HEADER];
+    memcpy(header, "C8PK", 4);
+    put_le(put_le(put_le(&header[4], PACK_VERSION, 2), 0, 2), corpus->count, 4);
+    bool written = fwrite(header, sizeof header, 1, file) == 1;
+    for (uint32_t i = 0; written && i < corpus->count; i++) {
+        const chip8_corpus_rom_t *rom = &corpus->roms[i];
+        const char *slash = strrchr(rom->name, '/');                                       // Packed ROMs keep only their file name
+        const char *name = slash != NULL ? slash + 1 : rom->name;
+        uint8_t entry[PACK_ENTRY];
+        put_le(&entry[4], rom->size, 4);
+        put_le(entry, strlen(name), 2);
+        entry[2] = rom->mode;
+        entry[3] = rom->quirks;
+        written = fwrite(entry, sizeof entry, 1, file) == 1 && fwrite(name, 1, strlen(name), file) == strlen(name) &&
+                  fwrite(rom->data, 1, rom->size, file) == rom->size;
+    }
+    written &= fclose(file) == 0;
+    if (!written) {
+        printf("Could not write packed corpus: %s\n", path);
+    }
+    return written;
+}
+
+// ROM named name, or NULL
+const chip8_corpus_rom_t *chip8_corpus_find(const chip8_corpus_t *corpus, const char name[]) {
+    for (uint32_t i = 0; i < corpus->count; i++) {
+        if (strcmp(corpus->roms[i].name, name) == 0) {
+            return &corpus->roms[i];
+        }
+    }
+    return NULL;
+}
+
+// Switch to the ROM's platform and quirk profile, then reset and copy it in from the mapped image
+bool chip8_corpus_load(chip8_t *chip8, const chip8_corpus_rom_t *rom) {
+    chip8_set_mode(chip8, rom->mode);
+    chip8_set_quirks(chip8, rom->quirks);
+    return chip8_load_rom(chip8, rom->data, rom->size);
+}
+
+// Hex SHA-1 of a ROM
+void chip8_corpus_sha1_hex(const chip8_corpus_rom_t *rom, char out[41]) {
+    for (uint32_t i = 0; i < 20; i++) {
+        snprintf(&out[2 * i], 3, "%02x", rom->sha1[i]);
+    }
+}
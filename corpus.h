@@ -0,0 +1,62 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "chip8.h"
+
+// One ROM of a corpus. data points into a read-only mapping, so every instance loading it copies
+// from the same pristine image and reloading never touches the disk
+typedef struct {
+    char *name;             // Path of the ROM file, or its name inside a packed corpus
+    uint8_t sha1[20];       // SHA-1 of the image
+    const uint8_t *data;    // ROM image
+    size_t size;            // Size of the image
+    uint8_t mode;           // Platform the ROM needs, MODE_CHIP8/SUPERCHIP/XOCHIP
+    quirks_t quirks;        // Quirk profile it runs under unless told otherwise
+} chip8_corpus_rom_t;
+
+// A file mapped (or, without mmap, read) into memory for as long as the corpus lives
+typedef struct {
+    void *base;
+    size_t size;
+} chip8_corpus_mapping_t;
+
+// Index of ROMs mapped from packed corpus files, directories of ROM files and single ROM files
+typedef struct {
+    chip8_corpus_rom_t *roms; // Every ROM added, in order
+    uint32_t count;         // ROMs in roms
+    uint32_t capacity;      // Room in roms before it grows
+    chip8_corpus_mapping_t *mappings; // Files the ROM images point into
+    uint32_t mapping_count;
+    uint32_t mapping_capacity;
+} chip8_corpus_t;
+
+// Allocate an empty corpus
+chip8_corpus_t *chip8_corpus_create(void);
+
+// Unmap every file and free the index. The ROM images are gone afterwards
+void chip8_corpus_destroy(chip8_corpus_t *corpus);
+
+// Map path and index the ROMs in it: every ROM of a packed corpus file, every file of a directory (in name order),
+// or path itself as one ROM
+bool chip8_corpus_add(chip8_corpus_t *corpus, const char path[]);
+
+// Write every ROM of the corpus, with its quirk profile, to path as one packed corpus file
+bool chip8_corpus_pack(const chip8_corpus_t *corpus, const char path[]);
+
+// ROM named name, or NULL
+const chip8_corpus_rom_t *chip8_corpus_find(const chip8_corpus_t *corpus, const char name[]);
+
+// Switch chip8 to the ROM's platform and quirk profile, then reset and copy the ROM in. chip8 needs the memory
+// of that platform (CHIP8_XO_MEMORY_SIZE for XO-Chip ROMs)
+bool chip8_corpus_load(chip8_t *chip8, const chip8_corpus_rom_t *rom);
+
+// Hex SHA-1 of a ROM into out, which holds 41 characters
+void chip8_corpus_sha1_hex(const chip8_corpus_rom_t *rom, char out[41]);
+
+// SHA-1 of size bytes of data, as the index uses for ROM images
+void chip8_sha1(const uint8_t *data, size_t size, uint8_t digest[20]);
+
+#endif
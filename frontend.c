@@ -0,0 +1,599 @@
+#define _POSIX_C_SOURCE 200809L                                                        // nanosleep
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "include/SDL2/SDL.h"
+#include "chip8.h"
+#include "rewind.h"
+#include "replay.h"
+#include "trace.h"
+#include "audio.h"
+#include "corpus.h"
+#include "present.h"
+
+typedef struct {
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    SDL_Texture *texture;   // One texel per chip-8 pixel, scaled up by SDL_RenderCopy
+    SDL_AudioSpec want, have;
+    SDL_AudioDeviceID device;
+    uint32_t window_scale;  // Window size scaling
+    chip8_audio_t *audio;   // Samples rendered each frame and drained by the audio callback
+    uint32_t pixels[128 * 64];  // Texels last uploaded to the texture, window_width per row
+    uint64_t shown[64][CHIP8_ROW_WORDS][CHIP8_PLANES]; // Display rows the texture currently holds
+    uint32_t shown_width;   // Resolution the texture was last drawn at, any change redraws every row
+} sdl_t;
+
+// Frontend settings that outlive a rom reset
+typedef struct {
+    const char *rom_name;   // Path the rom was given as, state and trace files go next to it
+    uint32_t rate;          // Instructions per second, changed by - and =
+    bool turbo;             // Run frames back to back, presenting once per display refresh
+    bool no_display_wait;   // Overrides the display wait of every quirk profile TAB switches to
+    bool rewinding;         // Backspace is held, frames are played backwards from history
+    uint16_t keys;          // Keypad bitmask last applied to the instance
+    chip8_rewind_t *history; // Every frame run, for rewinding. NULL if it could not be allocated
+    chip8_replay_t *record; // Input log being written, NULL when not recording
+} options_t;
+
+// Hotkeys, run on the emulation thread in this order when several come in between two frames
+typedef enum {
+    COMMAND_QUIT,           // ESC or closing the window
+    COMMAND_PAUSE,          // P
+    COMMAND_RESET,          // T
+    COMMAND_SAVE_STATE,     // F5
+    COMMAND_LOAD_STATE,     // F9
+    COMMAND_PROFILE,        // F7
+    COMMAND_TRACE,          // B
+    COMMAND_SLOWER,         // -
+    COMMAND_FASTER,         // =
+    COMMAND_TURBO,          // U
+    COMMAND_MODE,           // TAB
+} command_t;
+
+// Between the main thread, which owns the window and the event queue, and the emulation thread, which owns the instance
+typedef struct {
+    _Atomic uint16_t keys;  // Bit n is set while keypad key n is held, written by the main thread
+    _Atomic uint32_t commands; // Bit n is set when command n was given and has not run yet
+    _Atomic bool rewinding; // Backspace is held
+    _Atomic bool running;   // Cleared by the emulation thread as it stops
+    chip8_present_t *present; // Finished frames, from the emulation thread to the main thread
+    uint32_t frame_event;   // SDL user event pushed with each published frame, waking the main thread to draw it
+} shared_t;
+
+#define MAX_INSTRUCTIONS_PER_FRAME 1000000
+#define REWIND_BYTES (8 << 20)  // Rewind history, minutes of typical gameplay
+
+// Audio Control
+void audio_callback(void *userdata, uint8_t *stream, int len) {
+    chip8_audio_read(userdata, (int16_t *)stream, len / 2);
+}
+
+// Initialize SDL2 dependencies
+void initialize_sdl(sdl_t *sdl, chip8_t *chip8) {
+    sdl->window_scale = 12;
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER) != 0) {
+        printf("SDL Initialization Error: %s\n", SDL_GetError());
+    }
+    sdl->window = SDL_CreateWindow("Chipette", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, chip8->window_width * sdl->window_scale, chip8->window_height * sdl->window_scale, 0);
+    sdl->renderer = SDL_CreateRenderer(sdl->window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    sdl->texture = SDL_CreateTexture(sdl->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 128, 64);       // Big enough for high resolution
+    for (uint32_t i = 0; i < 128 * 64; i++) {
+        sdl->pixels[i] = 0xFF141414;
+    }
+    memset(sdl->shown, 0, sizeof sdl->shown);
+    sdl->shown_width = chip8->window_width;
+    SDL_UpdateTexture(sdl->texture, NULL, sdl->pixels, 128 * sizeof sdl->pixels[0]);
+    sdl->audio = chip8_audio_create(44100);
+    sdl->want = (SDL_AudioSpec) {.freq = 44100, .format = AUDIO_S16LSB, .channels = 1, .samples = 512, .callback = audio_callback, .userdata = sdl->audio};
+    sdl->device = sdl->audio != NULL ? SDL_OpenAudioDevice(NULL, 0, &sdl->want, &sdl->have, 0) : 0;
+    if (sdl->device != 0) {
+        sdl->audio->sample_rate = sdl->have.freq;
+        SDL_PauseAudioDevice(sdl->device, 0);                                               // Runs until exit, silence comes from the ring
+    }
+}
+
+// Render this frame's buzzer for the audio callback
+void update_audio(sdl_t *sdl, chip8_t *chip8) {
+    if (sdl->device != 0) {
+        chip8_audio_frame(sdl->audio, chip8);
+    }
+}
+
+// Clear the screen
+void clear_screen(sdl_t *sdl, const chip8_t *chip8) {
+    const SDL_Rect source = {.x = 0, .y = 0, .w = chip8->window_width, .h = chip8->window_height};
+    SDL_SetRenderDrawColor(sdl->renderer, 20, 20, 20, 255);
+    SDL_RenderClear(sdl->renderer);
+    SDL_RenderCopy(sdl->renderer, sdl->texture, &source, NULL);
+    SDL_RenderPresent(sdl->renderer);
+}
+
+// Draw a published frame, presenting only if it differs from what is on screen
+void update_screen(sdl_t *sdl, const chip8_frame_t *frame) {
+    const uint32_t colors[4] = {0xFF141414, 0xFFC8C8C8, 0xFF6E6E6E, 0xFFF5F5F5};             // Off, plane 0, plane 1, both
+    const bool resized = frame->window_width != sdl->shown_width;                            // 0x00FE/0x00FF, every row is stale
+    uint32_t top = frame->window_height;
+    uint32_t bottom = 0;
+    // Expand only the rows that really differ from what is on screen
+    for (uint32_t y = 0; y < frame->window_height; y++) {
+        const uint64_t (*row)[CHIP8_PLANES] = frame->display[y];
+        if (!resized && memcmp(row, sdl->shown[y], sizeof sdl->shown[y]) == 0) {
+            continue;
+        }
+        uint32_t *texel = &sdl->pixels[y * frame->window_width];
+        for (uint32_t x = 0; x < frame->window_width; x++) {
+            const uint64_t *word = row[x >> 6];
+            texel[x] = colors[((word[0] >> (63 - (x & 63))) & 1) | ((word[1] >> (63 - (x & 63))) & 1) << 1];
+        }
+        memcpy(sdl->shown[y], row, sizeof sdl->shown[y]);
+        top = y < top ? y : top;
+        bottom = y + 1;
+    }
+    sdl->shown_width = frame->window_width;
+    if (top >= bottom) {                                                                    // Nothing moved, skip the present
+        return;
+    }
+    const SDL_Rect rows = {.x = 0, .y = top, .w = frame->window_width, .h = bottom - top};
+    const SDL_Rect source = {.x = 0, .y = 0, .w = frame->window_width, .h = frame->window_height};
+    SDL_UpdateTexture(sdl->texture, &rows, &sdl->pixels[top * frame->window_width], frame->window_width * sizeof sdl->pixels[0]);
+    SDL_RenderCopy(sdl->renderer, sdl->texture, &source, NULL);
+    SDL_RenderPresent(sdl->renderer);                                                       // Blocks on vsync when the renderer supports it
+}
+
+// Quit everything
+void quit_all(sdl_t *sdl) {
+    SDL_DestroyTexture(sdl->texture);
+    SDL_DestroyRenderer(sdl->renderer);
+    SDL_DestroyWindow(sdl->window);
+    SDL_CloseAudioDevice(sdl->device);                                                      // Stops the callback before its ring goes
+    chip8_audio_destroy(sdl->audio);
+    SDL_Quit();
+}
+
+// Change the instructions run per frame, applied immediately
+void set_instructions_per_frame(chip8_t *chip8, options_t *options, uint32_t instructions_per_frame) {
+    if (instructions_per_frame < 1 || instructions_per_frame > MAX_INSTRUCTIONS_PER_FRAME) {
+        return;
+    }
+    options->rate = instructions_per_frame * 60;
+    chip8->emulation_rate = options->rate;
+    printf("INSTRUCTIONS PER FRAME: %u\n", instructions_per_frame);
+}
+
+// End the input log, e.g. when the run jumps to a state a replay could not reach
+void stop_recording(options_t *options) {
+    if (options->record != NULL) {
+        printf("RECORDING STOPPED AFTER %llu FRAMES\n", (unsigned long long)options->record->frames);
+        chip8_replay_close(options->record);
+        options->record = NULL;
+    }
+}
+
+#define KEYPAD 0x10         // Set in scancode_map for the scancodes on the keypad, the key is in the low 4 bits
+#define HOTKEY 0x20         // Set for the hotkeys, the command is in the low 4 bits
+
+// Keypad key or hotkey each scancode is mapped to, looked up directly for every key event
+static const uint8_t scancode_map[SDL_NUM_SCANCODES] = {
+    [SDL_SCANCODE_1] = KEYPAD | 0x1, [SDL_SCANCODE_2] = KEYPAD | 0x2, [SDL_SCANCODE_3] = KEYPAD | 0x3, [SDL_SCANCODE_4] = KEYPAD | 0xC,
+    [SDL_SCANCODE_Q] = KEYPAD | 0x4, [SDL_SCANCODE_W] = KEYPAD | 0x5, [SDL_SCANCODE_E] = KEYPAD | 0x6, [SDL_SCANCODE_R] = KEYPAD | 0xD,
+    [SDL_SCANCODE_A] = KEYPAD | 0x7, [SDL_SCANCODE_S] = KEYPAD | 0x8, [SDL_SCANCODE_D] = KEYPAD | 0x9, [SDL_SCANCODE_F] = KEYPAD | 0xE,
+    [SDL_SCANCODE_Z] = KEYPAD | 0xA, [SDL_SCANCODE_X] = KEYPAD | 0x0, [SDL_SCANCODE_C] = KEYPAD | 0xB, [SDL_SCANCODE_V] = KEYPAD | 0xF,
+    [SDL_SCANCODE_ESCAPE] = HOTKEY | COMMAND_QUIT, [SDL_SCANCODE_P] = HOTKEY | COMMAND_PAUSE, [SDL_SCANCODE_T] = HOTKEY | COMMAND_RESET,
+    [SDL_SCANCODE_F5] = HOTKEY | COMMAND_SAVE_STATE, [SDL_SCANCODE_F9] = HOTKEY | COMMAND_LOAD_STATE, [SDL_SCANCODE_F7] = HOTKEY | COMMAND_PROFILE,
+    [SDL_SCANCODE_B] = HOTKEY | COMMAND_TRACE, [SDL_SCANCODE_MINUS] = HOTKEY | COMMAND_SLOWER, [SDL_SCANCODE_EQUALS] = HOTKEY | COMMAND_FASTER,
+    [SDL_SCANCODE_U] = HOTKEY | COMMAND_TURBO, [SDL_SCANCODE_TAB] = HOTKEY | COMMAND_MODE,
+};
+
+// Run a hotkey's command, on the emulation thread
+void run_command(chip8_t *chip8, options_t *options, command_t command) {
+    switch (command) {
+        case COMMAND_QUIT:                                                                  // Exit after this frame
+            chip8->state = 0;
+            break;
+        case COMMAND_PAUSE:                                                                 // P to Pause/Unpause
+            if (chip8->state == 1) {
+                chip8->state = 2;
+                printf("PAUSED\n");
+            }
+            else if (chip8->state == 2) {
+                chip8->state = 1;
+                printf("UNPAUSED\n");
+            }
+            break;
+        case COMMAND_RESET:                                                                 // Restart rom from the snapshot taken after loading
+            if (chip8_restore_snapshot(chip8) && options->record != NULL) {
+                chip8_record_reset(options->record);
+            }
+            break;
+        case COMMAND_SAVE_STATE: {                                                          // Save state next to the rom
+            char state_name[FILENAME_MAX];
+            snprintf(state_name, sizeof state_name, "%s.state", options->rom_name);
+            if (chip8_save_state_file(chip8, state_name)) {
+                printf("STATE SAVED\n");
+            }
+            break;
+        }
+        case COMMAND_LOAD_STATE: {                                                          // Load the state saved with F5
+            char state_name[FILENAME_MAX];
+            snprintf(state_name, sizeof state_name, "%s.state", options->rom_name);
+            if (chip8_load_state_file(chip8, state_name)) {
+                printf("STATE LOADED\n");
+                stop_recording(options);
+            }
+            break;
+        }
+        case COMMAND_PROFILE: {                                                             // Profile so far, needs a PROFILE=1 build
+            char profile_name[FILENAME_MAX];
+            snprintf(profile_name, sizeof profile_name, "%s.folded", options->rom_name);
+            if (chip8_profile_report(chip8, stdout) && chip8_profile_write_folded(chip8, profile_name)) {
+                printf("PROFILE WRITTEN TO %s\n", profile_name);
+            }
+            break;
+        }
+        case COMMAND_TRACE: {                                                               // Trace every instruction to <rom>.trace, at full speed
+            char trace_name[FILENAME_MAX];
+            snprintf(trace_name, sizeof trace_name, "%s.trace", options->rom_name);
+            if (chip8->trace == NULL) {
+                if (chip8_trace_start(chip8, trace_name)) {
+                    printf("DEBUG MODE ACTIVATED, TRACING TO %s\n", trace_name);
+                }
+            }
+            else {
+                const uint64_t dropped = chip8->trace->dropped;
+                if (chip8_trace_stop(chip8)) {
+                    printf("DEBUG MODE DEACTIVATED, %llu INSTRUCTIONS DROPPED FROM THE TRACE\n", (unsigned long long)dropped);
+                }
+            }
+            break;
+        }
+        case COMMAND_SLOWER:                                                                // Halve the instructions per frame
+            set_instructions_per_frame(chip8, options, options->rate / 60 / 2);
+            break;
+        case COMMAND_FASTER:                                                                // Double the instructions per frame
+            set_instructions_per_frame(chip8, options, options->rate / 60 * 2);
+            break;
+        case COMMAND_TURBO:                                                                 // Turbo: run frames back to back
+            options->turbo = !options->turbo;
+            printf(options->turbo ? "TURBO ON\n" : "TURBO OFF\n");
+            break;
+        case COMMAND_MODE:                                                                  // Swap between Chip-8, Superchip, and XO-Chip modes
+            stop_recording(options);                                                        // The log's mode no longer matches
+            chip8_set_mode(chip8, chip8->mode + 1);                                         // Along with the platform's quirk profile
+            if (options->no_display_wait) {
+                chip8->display_wait = false;
+            }
+            if (chip8->mode == MODE_CHIP8) {
+                printf("CHIP MODE: CHIP-8 (%s quirks)\n", chip8_quirks_name(chip8->quirks));
+            }
+            else if (chip8->mode == MODE_SUPERCHIP) {
+                printf("CHIP MODE: SUPERCHIP (%s quirks)\n", chip8_quirks_name(chip8->quirks));
+            }
+            else {
+                printf("CHIP MODE: XO-CHIP (%s quirks)\n", chip8_quirks_name(chip8->quirks));
+            }
+            break;
+    }
+}
+
+// Handle keyboard input on the main thread, passing keypad state and hotkeys on to the emulation thread
+void handle_input(shared_t *shared) {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        switch (event.type) {
+            case SDL_QUIT:  // End program when exiting
+                atomic_fetch_or(&shared->commands, 1u << COMMAND_QUIT);
+                break;
+            case SDL_KEYDOWN:
+            case SDL_KEYUP: {
+                const SDL_Scancode scancode = event.key.keysym.scancode;
+                const bool pressed = event.type == SDL_KEYDOWN;
+                const uint8_t mapped = scancode < SDL_NUM_SCANCODES ? scancode_map[scancode] : 0;
+                if (mapped & KEYPAD) {
+                    if (pressed) {
+                        atomic_fetch_or(&shared->keys, 1u << (mapped & 0xF));
+                    }
+                    else {
+                        atomic_fetch_and(&shared->keys, ~(1u << (mapped & 0xF)));
+                    }
+                }
+                else if (mapped & HOTKEY) {
+                    if (pressed) {
+                        atomic_fetch_or(&shared->commands, 1u << (mapped & 0xF));
+                    }
+                }
+                else if (scancode == SDL_SCANCODE_BACKSPACE) {                              // Rewind while held
+                    atomic_store(&shared->rewinding, pressed);
+                }
+                break;
+            }
+        }
+    }
+}
+
+// Catch the instance up with the main thread's input: keypad changes first, then every command given since
+void apply_input(chip8_t *chip8, options_t *options, shared_t *shared) {
+    const uint16_t keys = atomic_load(&shared->keys);
+    for (uint16_t changed = keys ^ options->keys; changed != 0; changed &= changed - 1) {
+        const uint8_t key = __builtin_ctz(changed);
+        chip8_set_key(chip8, key, (keys >> key) & 1);
+    }
+    options->keys = keys;
+    options->rewinding = atomic_load(&shared->rewinding);
+    for (uint32_t commands = atomic_exchange(&shared->commands, 0); commands != 0; commands &= commands - 1) {
+        run_command(chip8, options, __builtin_ctz(commands));
+    }
+}
+
+// Fixed 60Hz timestep anchored to the performance counter
+typedef struct {
+    uint64_t frequency;     // Performance counter ticks per second
+    uint64_t start;         // Counter value frame 0 was due at
+    uint64_t frames;        // Frames run since start
+    uint64_t skipped;       // Frames dropped because the loop fell too far behind
+} scheduler_t;
+
+#define MAX_CATCH_UP 4      // Frames run back to back after a stall before the rest are dropped
+
+// Anchor the schedule so the next frame is due now
+void reset_scheduler(scheduler_t *scheduler) {
+    scheduler->frequency = SDL_GetPerformanceFrequency();
+    scheduler->start = SDL_GetPerformanceCounter();
+    scheduler->frames = 0;
+}
+
+// Number of frames that are due, dropping and reporting any beyond MAX_CATCH_UP
+uint32_t frames_due(scheduler_t *scheduler) {
+    const uint64_t elapsed = SDL_GetPerformanceCounter() - scheduler->start;
+    const uint64_t target = elapsed * 60 / scheduler->frequency + 1;                       // Frame 0 is due at start
+    if (target <= scheduler->frames) {
+        return 0;
+    }
+    uint64_t due = target - scheduler->frames;
+    if (due > MAX_CATCH_UP) {
+        printf("Fell %.1f ms behind, skipping %llu frames\n", (due - 1) * 1000.0 / 60, (unsigned long long)(due - MAX_CATCH_UP));
+        scheduler->skipped += due - MAX_CATCH_UP;
+        scheduler->frames += due - MAX_CATCH_UP;
+        due = MAX_CATCH_UP;
+    }
+    return due;
+}
+
+// Sleep until the next frame is due
+void wait_for_frame(const scheduler_t *scheduler) {
+    const uint64_t due_at = scheduler->start + scheduler->frames * scheduler->frequency / 60;
+    const uint64_t now = SDL_GetPerformanceCounter();
+    if (due_at > now) {
+        const uint64_t ns = ((due_at - now) * 1000000000 + scheduler->frequency - 1) / scheduler->frequency; // Rounded up, so the loop wakes to a due frame instead of spinning
+        nanosleep(&(struct timespec) {.tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000}, NULL); // SDL_Delay only sleeps whole milliseconds
+    }
+}
+
+// Run one frame of emulation and timers
+void run_frame(sdl_t *sdl, chip8_t *chip8, scheduler_t *scheduler, options_t *options) {
+    scheduler->frames++;
+    if (options->history == NULL) {
+        options->rewinding = false;
+    }
+    if (options->rewinding) {                                                               // Step back one recorded frame instead, silently
+        stop_recording(options);
+        chip8_rewind_step(options->history, chip8);
+        return;
+    }
+    const uint32_t cycles = chip8_frame_cycles(chip8);                                      // emulation_rate / 60 instructions, cut short when a draw waits for the next frame
+    if (options->record != NULL) {
+        chip8_record_frame(options->record, chip8, cycles);
+    }
+    chip8_step(chip8, cycles);
+    if (chip8->break_reason != CHIP8_BREAK_NONE) {                                          // Pause on a breakpoint, P resumes past it
+        printf("PAUSED BY %s AT 0x%03X, PC=%03X\n", chip8_break_name(chip8->break_reason), chip8->break_address, chip8->PC);
+        chip8->state = 2;
+    }
+    update_audio(sdl, chip8);
+    chip8_update_timers(chip8);
+    if (options->history != NULL) {
+        chip8_rewind_push(options->history, chip8);
+    }
+}
+
+// Hand the display to the main thread if it changed, and wake it to draw
+void publish_frame(chip8_t *chip8, shared_t *shared) {
+    if (chip8->dirty_rows == 0) {
+        return;
+    }
+    chip8_present_publish(shared->present, chip8);
+    SDL_Event event = {.type = shared->frame_event};
+    SDL_PushEvent(&event);
+}
+
+// Everything the emulation thread works with
+typedef struct {
+    sdl_t *sdl;             // For the audio ring only, the window belongs to the main thread
+    chip8_t *chip8;
+    options_t *options;
+    shared_t *shared;
+    scheduler_t scheduler;
+} emulation_t;
+
+// Emulation thread: run frames on the 60Hz schedule and publish each one, never waiting on the display
+int emulation_main(void *arg) {
+    emulation_t *emulation = arg;
+    chip8_t *chip8 = emulation->chip8;
+    options_t *options = emulation->options;
+    scheduler_t *scheduler = &emulation->scheduler;
+    reset_scheduler(scheduler);
+    while (chip8->state != 0) {                                                             // Loop through the instructions until exiting the program
+        apply_input(chip8, options, emulation->shared);
+        if (chip8->state == 2) {
+            SDL_Delay(16);
+            reset_scheduler(scheduler);                                                     // Don't try to catch up on the paused time
+            continue;
+        }
+        if (options->turbo) {
+            const uint64_t present_at = SDL_GetPerformanceCounter() + scheduler->frequency / 60;
+            do {
+                run_frame(emulation->sdl, chip8, scheduler, options);
+            } while (SDL_GetPerformanceCounter() < present_at && chip8->state == 1);
+            publish_frame(chip8, emulation->shared);                                        // One frame per display refresh is all that can be seen
+            reset_scheduler(scheduler);                                                     // Resume normal speed from now when turbo ends
+            continue;
+        }
+        uint32_t due = frames_due(scheduler);
+        if (due == 0) {
+            wait_for_frame(scheduler);
+            continue;
+        }
+        for (; due > 0; due--) {
+            run_frame(emulation->sdl, chip8, scheduler, options);
+        }
+        publish_frame(chip8, emulation->shared);                                            // The draw opcodes (0xDXYN, 0x00E0, scrolls) mark rows dirty
+    }
+    atomic_store(&emulation->shared->running, false);
+    SDL_Event event = {.type = emulation->shared->frame_event};                            // Wake the main thread to see it
+    SDL_PushEvent(&event);
+    return 0;
+}
+
+// Main
+int main(int argc, char **argv) {
+    options_t options = {.rom_name = NULL, .rate = 0, .turbo = false, .no_display_wait = false, .rewinding = false, .history = NULL, .record = NULL};
+    uint8_t mode = MODE_COUNT;                                                              // MODE_COUNT takes the rom's platform and profile from the index
+    quirks_t quirks = QUIRKS_COUNT;                                                         // QUIRKS_COUNT keeps the mode's profile
+    const char *record_file = NULL;
+    const char *breakpoints[64];                                                            // Option and value pairs, armed once the instance exists
+    uint32_t breakpoint_count = 0;
+    int arg = 1;
+    for (; arg < argc - 1; arg++) {                                                         // Everything before the rom name is an option
+        if (strcmp(argv[arg], "--ipf") == 0 && arg + 1 < argc - 1) {
+            options.rate = strtoul(argv[++arg], NULL, 0) * 60;
+        }
+        else if (strcmp(argv[arg], "--turbo") == 0) {
+            options.turbo = true;
+        }
+        else if (strcmp(argv[arg], "--no-display-wait") == 0) {
+            options.no_display_wait = true;
+        }
+        else if (strcmp(argv[arg], "--mode") == 0 && arg + 1 < argc - 1) {
+            mode = MODE_COUNT;
+            arg++;
+            for (uint8_t i = 0; i < MODE_COUNT; i++) {
+                if (strncmp(argv[arg], chip8_mode_name(i), strlen(argv[arg])) == 0) {
+                    mode = i;
+                }
+            }
+            if (mode == MODE_COUNT) {
+                printf("Unknown mode: %s\n", argv[arg]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[arg], "--quirks") == 0 && arg + 1 < argc - 1) {
+            quirks = QUIRKS_COUNT;
+            arg++;
+            for (quirks_t i = 0; i < QUIRKS_COUNT; i++) {
+                if (strncmp(argv[arg], chip8_quirks_name(i), strlen(argv[arg])) == 0) {
+                    quirks = i;
+                    break;                                                                  // "schip" picks the first SuperChip profile
+                }
+            }
+            if (quirks == QUIRKS_COUNT) {
+                printf("Unknown quirk profile: %s\n", argv[arg]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[arg], "--record") == 0 && arg + 1 < argc - 1) {
+            record_file = argv[++arg];
+        }
+        else if ((strcmp(argv[arg], "--break") == 0 || strncmp(argv[arg], "--watch-", 8) == 0) && arg + 1 < argc - 1 && breakpoint_count < 64) {
+            breakpoints[breakpoint_count++] = argv[arg];
+            breakpoints[breakpoint_count++] = argv[++arg];
+        }
+        else {
+            printf("Unknown option: %s\n", argv[arg]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (arg >= argc) {
+        printf("Usage: %s [--ipf N] [--turbo] [--no-display-wait] [--mode chip8|schip|xochip] [--quirks chip8|schip-legacy|schip-modern|xochip] [--record file] [--break ADDR] [--watch-read|--watch-write ADDR[:LENGTH]] [--watch-reg VX|I] rom\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    options.rom_name = argv[arg];                                                           // Take input for rom name
+    chip8_t *chip8 = chip8_create_with_memory(CHIP8_XO_MEMORY_SIZE);                       // TAB can switch to XO-Chip at any time
+    sdl_t sdl;
+    if (chip8 == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    chip8_corpus_t *corpus = chip8_corpus_create();                                         // A packed corpus or directory plays its first rom
+    if (corpus == NULL || !chip8_corpus_add(corpus, options.rom_name) || corpus->count == 0) {
+        exit(EXIT_FAILURE);
+    }
+    const chip8_corpus_rom_t *rom = &corpus->roms[0];
+    if (mode == MODE_COUNT) {
+        mode = rom->mode;
+        quirks = quirks != QUIRKS_COUNT ? quirks : rom->quirks;
+    }
+    chip8->seed = time(NULL);                                                               // A different game every run, the input log keeps the seed
+    chip8_set_mode(chip8, mode);
+    if (quirks != QUIRKS_COUNT) {
+        chip8_set_quirks(chip8, quirks);
+    }
+    if (!chip8_load_rom(chip8, rom->data, rom->size) || !chip8_take_snapshot(chip8)) {
+        exit(EXIT_FAILURE);
+    }
+    chip8_corpus_destroy(corpus);                                                           // T restores the snapshot from here on
+    if (options.rate == 0 || options.rate > MAX_INSTRUCTIONS_PER_FRAME * 60) {
+        options.rate = chip8->emulation_rate;
+    }
+    chip8->emulation_rate = options.rate;
+    if (options.no_display_wait) {
+        chip8->display_wait = false;
+    }
+    for (uint32_t i = 0; i < breakpoint_count; i += 2) {
+        if (!chip8_parse_breakpoint(chip8, breakpoints[i], breakpoints[i + 1])) {
+            printf("Invalid %s: %s\n", breakpoints[i], breakpoints[i + 1]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    options.history = chip8_rewind_create(chip8, REWIND_BYTES);
+    if (record_file != NULL && (options.record = chip8_record_start(chip8, record_file)) == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    shared_t shared = {.present = chip8_present_create()};
+    if (shared.present == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&shared.running, true);
+    initialize_sdl(&sdl, chip8);
+    clear_screen(&sdl, chip8);
+    shared.frame_event = SDL_RegisterEvents(1);
+    emulation_t emulation = {.sdl = &sdl, .chip8 = chip8, .options = &options, .shared = &shared};
+    SDL_Thread *thread = SDL_CreateThread(emulation_main, "emulation", &emulation);     // Owns chip8 until it stops
+    if (thread == NULL) {
+        printf("Could not start the emulation thread: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+    while (atomic_load(&shared.running)) {
+        SDL_WaitEventTimeout(NULL, 100);                                                    // Input, or a frame to draw
+        handle_input(&shared);
+        const chip8_frame_t *frame = chip8_present_acquire(shared.present);
+        if (frame != NULL) {
+            update_screen(&sdl, frame);
+        }
+    }
+    SDL_WaitThread(thread, NULL);
+    const scheduler_t scheduler = emulation.scheduler;
+    if (scheduler.skipped > 0) {
+        printf("Skipped %llu frames in total\n", (unsigned long long)scheduler.skipped);
+    }
+    if (CHIP8_PROFILE) {
+        chip8_profile_report(chip8, stdout);
+    }
+    quit_all(&sdl);
+    chip8_present_destroy(shared.present);
+    stop_recording(&options);
+    chip8_rewind_destroy(options.history);
+    chip8_destroy(chip8);
+    exit(EXIT_FAILURE);                                                                     // Goodbye program
+}
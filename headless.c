@@ -0,0 +1,462 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chip8.h"
+#include "lanes.h"
+#include "replay.h"
+#include "trace.h"
+
+// Frames whose display hash is logged and checked against a golden log. A log is one "frame hash" line
+// per hashed frame, frames counted from 1 at the end of the first
+typedef struct {
+    uint64_t every;         // Hash every frame that is a multiple of this, 0 to hash only the listed frames
+    uint64_t *frames;       // Frames to hash in increasing order, from --hash-frames or the golden log
+    uint64_t *golden;       // Expected hash of each listed frame, NULL when not comparing
+    uint32_t count;         // Frames listed
+    uint32_t next;          // First listed frame not reached yet
+    FILE *log;              // Log being written, NULL if none
+} frame_hashes_t;
+
+// Append a frame to the list, growing it as needed
+bool add_hash_frame(frame_hashes_t *hashes, uint64_t frame, uint64_t hash) {
+    if ((hashes->count & (hashes->count - 1)) == 0) {                                       // Double the arrays at every power of two
+        const uint32_t capacity = hashes->count != 0 ? hashes->count * 2 : 64;
+        uint64_t *frames = realloc(hashes->frames, capacity * sizeof *frames);
+        if (frames == NULL) {
+            return false;
+        }
+        hashes->frames = frames;
+        uint64_t *golden = realloc(hashes->golden, capacity * sizeof *golden);
+        if (golden == NULL) {
+            return false;
+        }
+        hashes->golden = golden;
+    }
+    if (hashes->count != 0 && frame <= hashes->frames[hashes->count - 1]) {
+        printf("Hashed frames must increase: %llu\n", (unsigned long long)frame);
+        return false;
+    }
+    hashes->frames[hashes->count] = frame;
+    hashes->golden[hashes->count++] = hash;
+    return true;
+}
+
+// List the frames of a comma separated --hash-frames value
+bool parse_hash_frames(frame_hashes_t *hashes, const char *list) {
+    for (char *end; *list != '\0'; list = *end == ',' ? end + 1 : end) {
+        const uint64_t frame = strtoull(list, &end, 0);
+        if (end == list || (*end != ',' && *end != '\0') || frame == 0) {
+            printf("Invalid frame list: %s\n", list);
+            return false;
+        }
+        if (!add_hash_frame(hashes, frame, 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Read the frames and hashes of a golden log, which then decides which frames are hashed
+bool read_golden(frame_hashes_t *hashes, const char path[]) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Could not open golden log: %s\n", path);
+        return false;
+    }
+    hashes->count = 0;
+    hashes->every = 0;
+    unsigned long long frame, hash;
+    int fields;
+    while ((fields = fscanf(file, "%llu %llx", &frame, &hash)) == 2) {
+        if (!add_hash_frame(hashes, frame, hash)) {
+            fclose(file);
+            return false;
+        }
+    }
+    fclose(file);
+    if (fields != EOF || hashes->count == 0) {                                             // An empty log would pass without checking anything
+        printf("Invalid golden log: %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Hash the display at the end of frame if it is one to hash. Returns false on a golden mismatch
+bool hash_frame(frame_hashes_t *hashes, const chip8_t *chip8, uint64_t frame) {
+    const bool listed = hashes->next < hashes->count && hashes->frames[hashes->next] == frame;
+    if (!listed && (hashes->every == 0 || frame % hashes->every != 0)) {
+        return true;
+    }
+    const uint64_t hash = chip8_display_hash(chip8);
+    if (hashes->log != NULL) {
+        fprintf(hashes->log, "%llu %016llX\n", (unsigned long long)frame, (unsigned long long)hash);
+    }
+    if (!listed) {
+        return true;
+    }
+    hashes->next++;
+    if (hashes->golden != NULL && hashes->golden[hashes->next - 1] != hash) {
+        fprintf(stderr, "Frame %llu: display hash %016llX, golden %016llX\n", (unsigned long long)frame, (unsigned long long)hash, (unsigned long long)hashes->golden[hashes->next - 1]);
+        return false;
+    }
+    return true;
+}
+
+// Count the frames left to a halted run, hashing those due, then run all of their instructions in one go.
+// Returns false on a golden mismatch
+bool finish_halted(chip8_t *chip8, uint64_t instruction_limit, uint64_t frame_limit, uint64_t *instructions, uint64_t *frames, frame_hashes_t *hashes) {
+    bool matched = true;
+    uint64_t cycles = 0;
+    while ((instruction_limit == 0 || *instructions + cycles < instruction_limit) && (frame_limit == 0 || *frames < frame_limit)) {
+        uint32_t frame_cycles = chip8_frame_cycles(chip8);
+        if (instruction_limit != 0 && instruction_limit - *instructions - cycles < frame_cycles) {
+            frame_cycles = instruction_limit - *instructions - cycles;
+        }
+        cycles += frame_cycles;
+        chip8_update_timers(chip8);
+        (*frames)++;
+        if (!hash_frame(hashes, chip8, *frames)) {                                          // The display can no longer change, but a golden log may still disagree
+            matched = false;
+            break;
+        }
+    }
+    while (cycles > 0) {
+        const uint32_t budget = cycles < UINT32_MAX ? cycles : UINT32_MAX;
+        *instructions += chip8_step(chip8, budget);
+        cycles -= budget;
+    }
+    return matched;
+}
+
+// Run the interpreter as fast as possible and dump the final state. A replay supplies the keys and
+// instruction budget of every frame and the run ends with it, a recording logs them.
+// Returns false if a display hash did not match the golden log, or the run ended before its last frame
+bool run_headless(chip8_t *chip8, uint64_t instruction_limit, uint64_t frame_limit, chip8_replay_t *replay, chip8_replay_t *record, frame_hashes_t *hashes) {
+    bool matched = true;
+    uint64_t instructions = 0;
+    uint64_t frames = 0;
+    const clock_t start_time = clock();
+    while ((instruction_limit == 0 || instructions < instruction_limit) && (frame_limit == 0 || frames < frame_limit)) {
+        uint32_t cycles;
+        if (replay == NULL) {
+            cycles = chip8_frame_cycles(chip8);                                             // Same frames as the windowed loop, minus the delay
+        }
+        else if (!chip8_replay_frame(replay, chip8, &cycles)) {
+            break;
+        }
+        if (instruction_limit != 0 && instruction_limit - instructions < cycles) {
+            cycles = instruction_limit - instructions;
+        }
+        if (record != NULL) {
+            chip8_record_frame(record, chip8, cycles);
+        }
+        instructions += chip8_step(chip8, cycles);
+        if (chip8->break_reason != CHIP8_BREAK_NONE) {                                      // The run ends at the first breakpoint hit
+            fprintf(stderr, "Stopped by %s at 0x%03X, PC=%03X\n", chip8_break_name(chip8->break_reason), chip8->break_address, chip8->PC);
+            break;
+        }
+        chip8_update_timers(chip8);
+        frames++;
+        if (!hash_frame(hashes, chip8, frames)) {                                           // Stop at the first mismatch
+            matched = false;
+            break;
+        }
+        if (chip8->halted && replay == NULL && record == NULL) {                            // A halted ROM reads no timers or keys and draws nothing, so the rest can run as one step
+            matched = finish_halted(chip8, instruction_limit, frame_limit, &instructions, &frames, hashes);
+            break;
+        }
+    }
+    const double seconds = (double)(clock() - start_time) / CLOCKS_PER_SEC;
+    if (matched && hashes->golden != NULL && hashes->next < hashes->count) {
+        fprintf(stderr, "Run ended after frame %llu, before golden frame %llu\n", (unsigned long long)frames, (unsigned long long)hashes->frames[hashes->next]);
+        matched = false;
+    }
+    // Dump the display, registers, and index pointer. XO-Chip plane 1 shows as + alone and @ over plane 0
+    for (uint32_t y = 0; y < chip8->window_height; y++) {
+        for (uint32_t x = 0; x < chip8->window_width; x++) {
+            putchar(".#+@"[chip8_pixel(chip8, x, y)]);
+        }
+        putchar('\n');
+    }
+    for (uint8_t i = 0; i < sizeof chip8->V; i++) {
+        printf("V%X=%02X%c", i, chip8->V[i], i == 0xF ? '\n' : ' ');
+    }
+    printf("I=%03X PC=%03X\n", chip8->I, chip8->PC);
+    fprintf(stderr, "%s: %llu instructions, %llu frames in %.3f s (%.2f MIPS)\n", chip8_engine_name(chip8->engine), (unsigned long long)instructions, (unsigned long long)frames, seconds, seconds > 0 ? instructions / seconds / 1e6 : 0.0);
+    return matched;
+}
+
+// Keys lane holds during frame, so that every lane of a group follows its own path through the ROM
+uint16_t lane_keys(uint32_t lane, uint64_t frame) {
+    return ((frame / 16 + lane) % 2) ? 1u << ((lane + frame / 32) % 16) : 0;
+}
+
+// Run a group of lanes in lock step under different keys and print a hash of each final state
+void run_lanes(chip8_lanes_t *lanes, uint64_t frame_limit) {
+    uint64_t instructions = 0;
+    const clock_t start_time = clock();
+    for (uint64_t frame = 0; frame < frame_limit; frame++) {
+        for (uint32_t i = 0; i < lanes->count; i++) {
+            for (uint8_t key = 0; key < 16; key++) {
+                chip8_lanes_set_key(lanes, i, key, (lane_keys(i, frame) >> key) & 1);
+            }
+        }
+        instructions += chip8_lanes_step(lanes, chip8_frame_cycles(lanes->lane[0]));      // Rate and credit are configuration, no sync needed
+        chip8_lanes_update_timers(lanes);
+    }
+    const double seconds = (double)(clock() - start_time) / CLOCKS_PER_SEC;
+    for (uint32_t i = 0; i < lanes->count; i++) {
+        const chip8_t *chip8 = chip8_lanes_get(lanes, i);
+        printf("lane %u: hash=%016llX I=%03X PC=%03X\n", i, (unsigned long long)chip8_state_hash(chip8), chip8->I, chip8->PC);
+    }
+    fprintf(stderr, "lanes: %llu instructions on %u lanes, %.1f%% vectorized, %llu frames in %.3f s (%.2f MIPS)\n", (unsigned long long)instructions, lanes->count, lanes->vector_steps * 100.0 / (instructions ? instructions : 1), (unsigned long long)frame_limit, seconds, seconds > 0 ? instructions / seconds / 1e6 : 0.0);
+}
+
+// Main
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s [--instructions N] [--frames N] [--engine cached|threaded|block] [--mode chip8|schip|xochip] [--quirks chip8|schip-legacy|schip-modern|xochip] [--ipf N] [--no-display-wait] [--no-skip-idle] [--lanes N] [--seed N] [--load-state file] [--save-state file] [--record file] [--replay file] [--profile file] [--trace file] [--break ADDR] [--watch-read|--watch-write ADDR[:LENGTH]] [--watch-reg VX|I] [--hash-log file] [--hash-every N] [--hash-frames N,...] [--golden file] rom\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t instruction_limit = 0;
+    uint64_t frame_limit = 0;
+    engine_t engine = CHIP8_ENGINE;
+    uint8_t mode = MODE_CHIP8;
+    quirks_t quirks = QUIRKS_COUNT;                                                         // QUIRKS_COUNT keeps the mode's profile
+    uint32_t instructions_per_frame = 0;
+    bool no_display_wait = false;                                                           // Otherwise the quirk profile decides
+    bool no_skip_idle = false;
+    uint32_t lane_count = 0;
+    const char *load_state = NULL;
+    const char *save_state = NULL;
+    bool seeded = false;
+    uint64_t seed = 0;
+    const char *record_file = NULL;
+    const char *replay_file = NULL;
+    const char *profile_file = NULL;
+    const char *trace_file = NULL;
+    const char *breakpoints[64];                                                            // Option and value pairs, armed once the instance exists
+    uint32_t breakpoint_count = 0;
+    frame_hashes_t hashes = {0};
+    const char *hash_log = NULL;
+    const char *golden_file = NULL;
+    int arg = 1;
+    for (; arg < argc - 1; arg++) {                                                         // Everything before the rom name is an option
+        if (strcmp(argv[arg], "--instructions") == 0 && arg + 1 < argc - 1) {
+            instruction_limit = strtoull(argv[++arg], NULL, 0);
+        }
+        else if (strcmp(argv[arg], "--frames") == 0 && arg + 1 < argc - 1) {
+            frame_limit = strtoull(argv[++arg], NULL, 0);
+        }
+        else if (strcmp(argv[arg], "--engine") == 0 && arg + 1 < argc - 1) {
+            engine = ENGINE_COUNT;
+            arg++;
+            for (engine_t i = 0; i < ENGINE_COUNT; i++) {
+                if (strncmp(argv[arg], chip8_engine_name(i), strlen(argv[arg])) == 0) {
+                    engine = i;
+                }
+            }
+            if (engine == ENGINE_COUNT) {
+                printf("Unknown engine: %s\n", argv[arg]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[arg], "--mode") == 0 && arg + 1 < argc - 1) {
+            mode = MODE_COUNT;
+            arg++;
+            for (uint8_t i = 0; i < MODE_COUNT; i++) {
+                if (strncmp(argv[arg], chip8_mode_name(i), strlen(argv[arg])) == 0) {
+                    mode = i;
+                }
+            }
+            if (mode == MODE_COUNT) {
+                printf("Unknown mode: %s\n", argv[arg]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[arg], "--quirks") == 0 && arg + 1 < argc - 1) {
+            quirks = QUIRKS_COUNT;
+            arg++;
+            for (quirks_t i = 0; i < QUIRKS_COUNT; i++) {
+                if (strncmp(argv[arg], chip8_quirks_name(i), strlen(argv[arg])) == 0) {
+                    quirks = i;
+                    break;                                                                  // "schip" picks the first SuperChip profile
+                }
+            }
+            if (quirks == QUIRKS_COUNT) {
+                printf("Unknown quirk profile: %s\n", argv[arg]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[arg], "--ipf") == 0 && arg + 1 < argc - 1) {
+            instructions_per_frame = strtoul(argv[++arg], NULL, 0);
+        }
+        else if (strcmp(argv[arg], "--no-display-wait") == 0) {
+            no_display_wait = true;
+        }
+        else if (strcmp(argv[arg], "--no-skip-idle") == 0) {
+            no_skip_idle = true;
+        }
+        else if (strcmp(argv[arg], "--load-state") == 0 && arg + 1 < argc - 1) {
+            load_state = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--save-state") == 0 && arg + 1 < argc - 1) {
+            save_state = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--seed") == 0 && arg + 1 < argc - 1) {
+            seed = strtoull(argv[++arg], NULL, 0);
+            seeded = true;
+        }
+        else if (strcmp(argv[arg], "--record") == 0 && arg + 1 < argc - 1) {
+            record_file = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--replay") == 0 && arg + 1 < argc - 1) {
+            replay_file = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--profile") == 0 && arg + 1 < argc - 1) {
+            profile_file = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc - 1) {
+            trace_file = argv[++arg];
+        }
+        else if ((strcmp(argv[arg], "--break") == 0 || strncmp(argv[arg], "--watch-", 8) == 0) && arg + 1 < argc - 1 && breakpoint_count < 64) {
+            breakpoints[breakpoint_count++] = argv[arg];
+            breakpoints[breakpoint_count++] = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--hash-log") == 0 && arg + 1 < argc - 1) {
+            hash_log = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--hash-every") == 0 && arg + 1 < argc - 1) {
+            hashes.every = strtoull(argv[++arg], NULL, 0);
+        }
+        else if (strcmp(argv[arg], "--hash-frames") == 0 && arg + 1 < argc - 1) {
+            if (!parse_hash_frames(&hashes, argv[++arg])) {
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[arg], "--golden") == 0 && arg + 1 < argc - 1) {
+            golden_file = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--lanes") == 0 && arg + 1 < argc - 1) {
+            lane_count = strtoul(argv[++arg], NULL, 0);
+            if (lane_count == 0 || lane_count > CHIP8_LANES) {
+                printf("Lanes must be between 1 and %d\n", CHIP8_LANES);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else {
+            printf("Unknown option: %s\n", argv[arg]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    const char *rom_name = argv[arg];                                                       // Take input for rom name
+    if (golden_file != NULL && !read_golden(&hashes, golden_file)) {                         // The golden log's frames replace --hash-every and --hash-frames
+        exit(EXIT_FAILURE);
+    }
+    if (golden_file == NULL) {
+        free(hashes.golden);                                                                // Only the frame list is needed
+        hashes.golden = NULL;
+    }
+    if (hash_log != NULL && hashes.every == 0 && hashes.count == 0) {
+        hashes.every = 1;                                                                   // Log every frame unless told which
+    }
+    if (hash_log != NULL && (hashes.log = fopen(hash_log, "w")) == NULL) {
+        printf("Could not create hash log: %s\n", hash_log);
+        exit(EXIT_FAILURE);
+    }
+    if (instruction_limit == 0 && frame_limit == 0 && replay_file == NULL) {
+        frame_limit = golden_file != NULL && hashes.count != 0 ? hashes.frames[hashes.count - 1] : 600; // Default to the golden log, or ten seconds of emulated time
+    }
+    const uint32_t memory_size = mode == MODE_XOCHIP ? CHIP8_XO_MEMORY_SIZE : CHIP8_MEMORY_SIZE;
+    if (lane_count != 0) {                                                                  // Lanes only stop on the frame limit
+        chip8_lanes_t *lanes = chip8_lanes_create(lane_count, memory_size);
+        if (lanes == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        for (uint32_t i = 0; i < lane_count; i++) {
+            chip8_t *chip8 = chip8_lanes_get(lanes, i);
+            if (seeded) {
+                chip8->seed = seed;
+            }
+            chip8_set_mode(chip8, mode);
+            if (quirks != QUIRKS_COUNT) {
+                chip8_set_quirks(chip8, quirks);
+            }
+            if (!chip8_load_rom_file(chip8, rom_name) || (load_state != NULL && !chip8_load_state_file(chip8, load_state))) {
+                exit(EXIT_FAILURE);
+            }
+            if (no_display_wait) {
+                chip8->display_wait = false;
+            }
+            if (instructions_per_frame != 0) {
+                chip8->emulation_rate = instructions_per_frame * 60;
+            }
+        }
+        run_lanes(lanes, frame_limit != 0 ? frame_limit : 600);
+        chip8_lanes_destroy(lanes);
+        exit(EXIT_SUCCESS);
+    }
+    chip8_t *chip8 = chip8_create_with_memory(memory_size);
+    if (chip8 == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    if (seeded) {
+        chip8->seed = seed;                                                                 // Before loading, so the reset picks it up
+    }
+    chip8_set_mode(chip8, mode);                                                            // A loaded state may be in high resolution
+    if (quirks != QUIRKS_COUNT) {
+        chip8_set_quirks(chip8, quirks);
+    }
+    if (!chip8_load_rom_file(chip8, rom_name) || (load_state != NULL && !chip8_load_state_file(chip8, load_state))) {
+        exit(EXIT_FAILURE);
+    }
+    chip8->engine = engine;
+    chip8->skip_idle = !no_skip_idle;
+    if (no_display_wait) {
+        chip8->display_wait = false;
+    }
+    if (instructions_per_frame != 0) {
+        chip8->emulation_rate = instructions_per_frame * 60;
+    }
+    chip8_replay_t *replay = NULL;
+    chip8_replay_t *record = NULL;
+    if (replay_file != NULL && (replay = chip8_replay_start(chip8, replay_file)) == NULL) {     // Overrides the seed, display wait, mode and quirks
+        exit(EXIT_FAILURE);
+    }
+    if (record_file != NULL && (record = chip8_record_start(chip8, record_file)) == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < breakpoint_count; i += 2) {
+        if (!chip8_parse_breakpoint(chip8, breakpoints[i], breakpoints[i + 1])) {
+            printf("Invalid %s: %s\n", breakpoints[i], breakpoints[i + 1]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (trace_file != NULL && !chip8_trace_start(chip8, trace_file)) {
+        exit(EXIT_FAILURE);
+    }
+    bool passed = run_headless(chip8, instruction_limit, frame_limit, replay, record, &hashes);
+    if (chip8->trace != NULL) {
+        fprintf(stderr, "trace: %llu instructions dropped\n", (unsigned long long)chip8->trace->dropped);
+        if (!chip8_trace_stop(chip8)) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    chip8_replay_close(replay);
+    chip8_replay_close(record);
+    bool saved = save_state == NULL || chip8_save_state_file(chip8, save_state);
+    if (profile_file != NULL) {                                                             // Report to stderr, stdout stays comparable between runs
+        saved &= chip8_profile_report(chip8, stderr) && chip8_profile_write_folded(chip8, profile_file);
+    }
+    if (hashes.log != NULL && fclose(hashes.log) != 0) {
+        printf("Could not write hash log: %s\n", hash_log);
+        passed = false;
+    }
+    free(hashes.frames);
+    free(hashes.golden);
+    chip8_destroy(chip8);
+    exit(saved && passed ? EXIT_SUCCESS : EXIT_FAILURE);
+}
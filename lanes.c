@@ -0,0 +1,445 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lanes.h"
+
+#if defined(__GNUC__)
+typedef uint8_t lane_vector_t __attribute__((vector_size(CHIP8_LANES)));
+#endif
+
+// How an opcode touches the registers, deciding whether they have to move between V and the lane's instance
+enum {
+    ACCESS_NONE,            // Run by the lane's instance without touching the registers (0x00E0, 0x00EE, 0x2NNN)
+    ACCESS_SCALAR,          // Run by the lane's instance, which needs the registers before and V needs them after
+    ACCESS_VECTOR           // Run on V and PC for the whole group (0x1NNN, 0x3XNN-0x9XY0, 0xANNN, 0xBNNN)
+};
+
+// Allocate count lanes, each an instance with the default configuration
+chip8_lanes_t *chip8_lanes_create(uint32_t count, uint32_t memory_size) {
+    if (count == 0 || count > CHIP8_LANES) {
+        return NULL;
+    }
+    chip8_lanes_t *lanes = calloc(1, sizeof *lanes);
+    if (lanes == NULL) {
+        return NULL;
+    }
+    lanes->count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        lanes->lane[i] = chip8_create_with_memory(memory_size);
+        if (lanes->lane[i] == NULL) {
+            chip8_lanes_destroy(lanes);
+            return NULL;
+        }
+    }
+    lanes->soa_stale = (1u << count) - 1;
+    return lanes;
+}
+
+// Free a lane group and its instances
+void chip8_lanes_destroy(chip8_lanes_t *lanes) {
+    if (lanes != NULL) {
+        for (uint32_t i = 0; i < lanes->count; i++) {
+            chip8_destroy(lanes->lane[i]);
+        }
+    }
+    free(lanes);
+}
+
+// Copy the registers and program counter of the lanes in mask from their instances
+static void gather_registers(chip8_lanes_t *lanes, uint32_t mask) {
+    for (uint32_t i = 0; mask != 0; i++, mask >>= 1) {
+        if (mask & 1) {
+            for (uint8_t r = 0; r < 16; r++) {
+                lanes->V[r][i] = lanes->lane[i]->V[r];
+            }
+            lanes->PC[i] = lanes->lane[i]->PC;
+        }
+    }
+}
+
+// Copy one lane's registers from V back into its instance if they changed there
+static void scatter_registers(chip8_lanes_t *lanes, uint32_t lane) {
+    if (lanes->aos_stale & (1u << lane)) {
+        for (uint8_t r = 0; r < 16; r++) {
+            lanes->lane[lane]->V[r] = lanes->V[r][lane];
+        }
+        lanes->aos_stale &= ~(1u << lane);
+    }
+}
+
+// Instance of one lane with its registers up to date
+chip8_t *chip8_lanes_get(chip8_lanes_t *lanes, uint32_t lane) {
+    scatter_registers(lanes, lane);
+    if (!(lanes->soa_stale & (1u << lane))) {
+        lanes->lane[lane]->PC = lanes->PC[lane];
+    }
+    lanes->soa_stale |= 1u << lane;                                                         // The caller may change them
+    return lanes->lane[lane];
+}
+
+// Press or release a keypad key of one lane
+void chip8_lanes_set_key(chip8_lanes_t *lanes, uint32_t lane, uint8_t key, bool pressed) {
+    chip8_set_key(lanes->lane[lane], key, pressed);
+}
+
+// Rebuild the map of addresses whose contents differ between lanes, after callers had the instances
+static void compare_memory(chip8_lanes_t *lanes) {
+    const uint8_t *first = lanes->lane[0]->memory;
+    memset(lanes->divergent, 0, sizeof lanes->divergent);
+    for (uint32_t i = 1; i < lanes->count; i++) {
+        const uint8_t *memory = lanes->lane[i]->memory;
+        for (uint32_t word = 0; word < lanes->lane[0]->memory_size / 64; word++) {
+            if (memcmp(&memory[word * 64], &first[word * 64], 64) == 0) {
+                continue;
+            }
+            for (uint32_t bit = 0; bit < 64; bit++) {
+                if (memory[word * 64 + bit] != first[word * 64 + bit]) {
+                    lanes->divergent[word] |= 1ull << bit;
+                }
+            }
+        }
+    }
+}
+
+// Note that a lane is about to write length bytes from address, which may then differ from the other lanes
+static void mark_divergent(chip8_lanes_t *lanes, uint16_t address, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        const uint16_t byte = (address + i) & (lanes->lane[0]->memory_size - 1);
+        lanes->divergent[byte / 64] |= 1ull << (byte % 64);
+    }
+}
+
+// Whether the opcode at address may differ between lanes
+static bool is_divergent(const chip8_lanes_t *lanes, uint16_t address) {
+    const uint16_t mask = lanes->lane[0]->memory_size - 1;
+    const uint16_t second = (address + 1) & mask;
+    address &= mask;
+    return ((lanes->divergent[address / 64] >> (address % 64)) | (lanes->divergent[second / 64] >> (second % 64))) & 1;
+}
+
+// Opcode at a lane's program counter
+static uint16_t fetch_opcode(const chip8_lanes_t *lanes, uint32_t lane) {
+    const uint8_t *memory = lanes->lane[lane]->memory;
+    const uint16_t mask = lanes->lane[lane]->memory_size - 1;
+    return memory[lanes->PC[lane] & mask] << 8 | memory[(lanes->PC[lane] + 1) & mask];
+}
+
+// How an opcode uses the registers. XO-Chip skips run scalar, since they skip four bytes over 0xF000 NNNN,
+// and so do the opcodes the quirk profiles change, since the vectors only implement the original Chip-8's
+static uint8_t register_access(uint16_t opcode, const chip8_t *chip8) {
+    if (chip8->mode == MODE_XOCHIP && ((opcode >> 12) == 0x3 || (opcode >> 12) == 0x4 || (opcode >> 12) == 0x5 || (opcode >> 12) == 0x9)) {
+        return ACCESS_SCALAR;                                                               // 0x5XY2 and 0x5XY3 among them
+    }
+    if (chip8->quirks != QUIRKS_CHIP8 && ((opcode >> 12) == 0xB || ((opcode >> 12) == 0x8 && ((opcode & 0xF) - 1u < 3 || (opcode & 0xF) == 0x6 || (opcode & 0xF) == 0xE)))) {
+        return ACCESS_SCALAR;                                                               // 0x8XY1-0x8XY3, 0x8XY6, 0x8XYE and 0xBNNN
+    }
+    switch (opcode >> 12) {
+        case 0x0:
+        case 0x2:
+            return ACCESS_NONE;
+#if defined(__GNUC__)
+        case 0x1:
+        case 0xA:
+        case 0xB:
+        case 0x3:
+        case 0x4:
+        case 0x5:                                                                           // Decoded as 0x5XY0/0x9XY0 whatever N is
+        case 0x6:
+        case 0x7:
+        case 0x9:
+            return ACCESS_VECTOR;
+        case 0x8:
+            return (opcode & 0xF) <= 0x7 || (opcode & 0xF) == 0xE ? ACCESS_VECTOR : ACCESS_NONE;
+        default:
+            return ACCESS_SCALAR;
+#else
+        case 0x1:
+        case 0xA:
+            return ACCESS_NONE;
+        default:
+            return ACCESS_SCALAR;
+#endif
+    }
+}
+
+#if defined(__GNUC__)
+// Apply 0x3XNN-0x9XY0 to the lanes set in in_group (0xFF), which all share the opcode's address.
+// Returns 0xFF in the lanes that skip the next instruction
+static lane_vector_t execute_vector(chip8_lanes_t *lanes, uint16_t opcode, lane_vector_t in_group) {
+    const uint8_t X = (opcode >> 8) & 0xF;
+    const uint8_t Y = (opcode >> 4) & 0xF;
+    lane_vector_t *V = (lane_vector_t *)lanes->V;
+    const lane_vector_t vx = V[X];
+    const lane_vector_t vy = V[Y];
+    const lane_vector_t zero = {0};
+    const lane_vector_t nn = zero + (uint8_t)opcode;
+    lane_vector_t result;
+    lane_vector_t flag;
+    switch (opcode >> 12) {
+        case 0x3:                                                                           // 0x3XNN
+            return (lane_vector_t)(vx == nn);
+        case 0x4:                                                                           // 0x4XNN
+            return (lane_vector_t)(vx != nn);
+        case 0x5:                                                                           // 0x5XY0
+            return (lane_vector_t)(vx == vy);
+        case 0x9:                                                                           // 0x9XY0
+            return (lane_vector_t)(vx != vy);
+        case 0x6:                                                                           // 0x6XNN
+            V[X] = (nn & in_group) | (vx & ~in_group);
+            return zero;
+        case 0x7:                                                                           // 0x7XNN
+            V[X] = ((vx + nn) & in_group) | (vx & ~in_group);
+            return zero;
+        default:
+            break;
+    }
+    switch (opcode & 0xF) {
+        case 0x0:                                                                           // 0x8XY0
+            V[X] = (vy & in_group) | (vx & ~in_group);
+            return zero;
+        case 0x1:                                                                           // 0x8XY1
+            result = vx | vy;
+            flag = zero;
+            break;
+        case 0x2:                                                                           // 0x8XY2
+            result = vx & vy;
+            flag = zero;
+            break;
+        case 0x3:                                                                           // 0x8XY3
+            result = vx ^ vy;
+            flag = zero;
+            break;
+        case 0x4:                                                                           // 0x8XY4
+            result = vx + vy;
+            flag = (lane_vector_t)(result < vx) & 1;
+            break;
+        case 0x5:                                                                           // 0x8XY5
+            result = vx - vy;
+            flag = (lane_vector_t)(vy <= vx) & 1;
+            break;
+        case 0x6:                                                                           // 0x8XY6
+            result = vy >> 1;
+            flag = vy & 1;
+            break;
+        case 0x7:                                                                           // 0x8XY7
+            result = vy - vx;
+            flag = (lane_vector_t)(vx <= vy) & 1;
+            break;
+        default:                                                                            // 0x8XYE
+            result = vy << 1;
+            flag = vy >> 7;
+            break;
+    }
+    V[X] = (result & in_group) | (vx & ~in_group);                                          // Lanes outside the group keep their registers
+    V[0xF] = (flag & in_group) | (V[0xF] & ~in_group);                                      // Written last, as the scalar handlers do
+    return zero;
+}
+
+// Run an opcode with a vector form on the lanes in group, advancing each lane's own PC
+static void step_group(chip8_lanes_t *lanes, uint16_t opcode, uint32_t group) {
+    const uint16_t NNN = opcode & 0x0FFF;
+    lane_vector_t in_group;
+    for (uint32_t i = 0; i < CHIP8_LANES; i++) {
+        in_group[i] = (group >> i) & 1 ? 0xFF : 0;
+    }
+    switch (opcode >> 12) {
+        case 0x1:                                                                           // 0x1NNN
+            for (uint32_t i = 0; i < CHIP8_LANES; i++) {
+                lanes->PC[i] = in_group[i] ? NNN : lanes->PC[i];
+            }
+            break;
+        case 0xA:                                                                           // 0xANNN
+            for (uint32_t i = 0; i < lanes->count; i++) {
+                if (in_group[i]) {
+                    lanes->lane[i]->I = NNN;
+                    lanes->PC[i] += 2;
+                }
+            }
+            break;
+        case 0xB:                                                                           // 0xBNNN
+            for (uint32_t i = 0; i < CHIP8_LANES; i++) {
+                lanes->PC[i] = in_group[i] ? lanes->V[0][i] + NNN : lanes->PC[i];
+            }
+            break;
+        default: {
+            const lane_vector_t skip = execute_vector(lanes, opcode, in_group);
+            for (uint32_t i = 0; i < CHIP8_LANES; i++) {
+                lanes->PC[i] += (2 + (skip[i] & 2)) & in_group[i];
+            }
+            lanes->aos_stale |= group;
+            break;
+        }
+    }
+}
+
+// While every lane is at the same address, run opcodes with a vector form on one shared PC, without
+// the per-lane bookkeeping of step_group. Returns the instructions each lane ran, at most budget
+static uint32_t run_converged(chip8_lanes_t *lanes, uint32_t budget) {
+    const chip8_t *first = lanes->lane[0];
+    const uint16_t mask = first->memory_size - 1;
+    lane_vector_t active = {0};                                                             // Lanes in use
+    for (uint32_t i = 0; i < lanes->count; i++) {
+        active[i] = 0xFF;
+    }
+    uint16_t PC = lanes->PC[0];
+    uint32_t steps = 0;
+    while (steps < budget && !is_divergent(lanes, PC)) {
+        const uint16_t opcode = first->memory[PC & mask] << 8 | first->memory[(PC + 1) & mask];
+        if (register_access(opcode, lanes->lane[0]) != ACCESS_VECTOR) {
+            break;
+        }
+        if ((opcode >> 12) == 0x1) {                                                        // 0x1NNN
+            PC = opcode & 0x0FFF;
+        }
+        else if ((opcode >> 12) == 0xA || (opcode >> 12) == 0xB) {                          // Per-lane I or jump target, step_group's job
+            break;
+        }
+        else {
+            const lane_vector_t skip = execute_vector(lanes, opcode, active) & active;
+            uint64_t halves[2];
+            memcpy(halves, &skip, sizeof halves);
+            if ((halves[0] | halves[1]) == 0) {
+                PC += 2;
+            }
+            else if (memcmp(&skip, &active, sizeof skip) == 0) {
+                PC += 4;
+            }
+            else {                                                                          // The lanes split here
+                for (uint32_t i = 0; i < CHIP8_LANES; i++) {
+                    lanes->PC[i] = PC + 2 + (skip[i] & 2);
+                }
+                lanes->aos_stale = (1u << lanes->count) - 1;
+                return steps + 1;
+            }
+        }
+        steps++;
+    }
+    for (uint32_t i = 0; i < CHIP8_LANES; i++) {
+        lanes->PC[i] = PC;
+    }
+    if (steps != 0) {
+        lanes->aos_stale = (1u << lanes->count) - 1;
+    }
+    return steps;
+}
+#endif
+
+// Run one instruction on one lane through its own instance. Returns whether it drew
+static bool step_scalar(chip8_lanes_t *lanes, uint32_t lane, uint16_t opcode) {
+    chip8_t *chip8 = lanes->lane[lane];
+    const bool uses_registers = register_access(opcode, lanes->lane[0]) == ACCESS_SCALAR;
+    if (uses_registers) {
+        scatter_registers(lanes, lane);
+    }
+    if ((opcode & 0xF0FF) == 0xF033) {                                                      // The only opcodes that write memory
+        mark_divergent(lanes, chip8->I, 3);
+    }
+    else if ((opcode & 0xF0FF) == 0xF055) {
+        mark_divergent(lanes, chip8->I, ((opcode >> 8) & 0xF) + 1);
+    }
+    else if ((opcode & 0xF00F) == 0x5002 && chip8->mode == MODE_XOCHIP) {
+        const uint8_t X = (opcode >> 8) & 0xF;
+        const uint8_t Y = (opcode >> 4) & 0xF;
+        mark_divergent(lanes, chip8->I, (X > Y ? X - Y : Y - X) + 1);
+    }
+    chip8->PC = lanes->PC[lane];
+    instruction_t instruction;
+    emulate_instruction(chip8, &instruction);
+    lanes->PC[lane] = chip8->PC;
+    if (uses_registers) {
+        for (uint8_t r = 0; r < 16; r++) {
+            lanes->V[r][lane] = chip8->V[r];
+        }
+    }
+    return (instruction.opcode >> 12) == 0xD;
+}
+
+// Each step runs the lanes at the lowest address that hold the same opcode there, so lanes split by a
+// skip meet again one instruction later. Opcodes with a vector form run once for the whole group
+uint64_t chip8_lanes_step(chip8_lanes_t *lanes, uint32_t cycles) {
+    if (lanes->soa_stale != 0) {                                                            // Callers had instances, and may have written memory
+        gather_registers(lanes, lanes->soa_stale);
+        lanes->soa_stale = 0;
+        compare_memory(lanes);
+    }
+    const uint32_t all = (1u << lanes->count) - 1;
+    uint32_t executed[CHIP8_LANES] = {0};
+    uint32_t running = cycles != 0 ? all : 0;                                               // Lanes with budget left that have not stopped at a draw
+    while (running != 0) {
+#if defined(__GNUC__)
+        if (running == all) {
+            uint32_t most = 0;
+            bool converged = true;
+            for (uint32_t i = 0; i < lanes->count; i++) {
+                most = executed[i] > most ? executed[i] : most;
+                converged &= lanes->PC[i] == lanes->PC[0];
+            }
+            const uint32_t steps = converged ? run_converged(lanes, cycles - most) : 0;
+            if (steps != 0) {
+                lanes->vector_steps += (uint64_t)steps * lanes->count;
+                for (uint32_t i = 0; i < lanes->count; i++) {
+                    executed[i] += steps;
+                    if (executed[i] == cycles) {
+                        running &= ~(1u << i);
+                    }
+                }
+                continue;
+            }
+        }
+#endif
+        uint32_t leader = 0;
+        while (!(running & (1u << leader))) {
+            leader++;
+        }
+        for (uint32_t i = leader + 1; i < lanes->count; i++) {
+            if ((running & (1u << i)) && lanes->PC[i] < lanes->PC[leader]) {
+                leader = i;
+            }
+        }
+        const uint16_t opcode = fetch_opcode(lanes, leader);
+        const bool divergent = is_divergent(lanes, lanes->PC[leader]);
+        uint32_t group = 0;
+        uint32_t members = 0;
+        for (uint32_t i = leader; i < lanes->count; i++) {                                  // Only compare opcodes where a lane wrote memory
+            if ((running & (1u << i)) && lanes->PC[i] == lanes->PC[leader] && (!divergent || fetch_opcode(lanes, i) == opcode)) {
+                group |= 1u << i;
+                members++;
+            }
+        }
+        uint32_t drew = 0;
+#if defined(__GNUC__)
+        if (register_access(opcode, lanes->lane[0]) == ACCESS_VECTOR) {
+            step_group(lanes, opcode, group);
+            lanes->vector_steps += members;
+        }
+        else
+#endif
+        {
+            for (uint32_t i = leader; i < lanes->count; i++) {
+                if ((group & (1u << i)) && step_scalar(lanes, i, opcode) && lanes->lane[i]->display_wait) {
+                    drew |= 1u << i;
+                }
+            }
+            lanes->scalar_steps += members;
+        }
+        for (uint32_t i = leader; i < lanes->count; i++) {
+            if (group & (1u << i)) {
+                if (++executed[i] == cycles) {
+                    running &= ~(1u << i);
+                }
+            }
+        }
+        running &= ~drew;
+    }
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < lanes->count; i++) {
+        total += executed[i];
+    }
+    return total;
+}
+
+// Decrement the timers of every lane
+void chip8_lanes_update_timers(chip8_lanes_t *lanes) {
+    for (uint32_t i = 0; i < lanes->count; i++) {
+        chip8_update_timers(lanes->lane[i]);
+    }
+}
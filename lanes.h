@@ -0,0 +1,45 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "chip8.h"
+
+// Instances stepped together by one lane group, one byte of a 16-byte vector each
+#define CHIP8_LANES 16
+
+// Instances running the same ROM in lock step, e.g. under different keypad input. Lanes at the same address
+// run jumps, skips, 0xANNN and the ALU opcodes on V together, everything else goes through each lane's instance
+typedef struct {
+    uint32_t count;                 // Lanes in use, at most CHIP8_LANES
+    chip8_t *lane[CHIP8_LANES];     // Memory, display, stack, timers and keypad of each lane
+    _Alignas(16) uint8_t V[16][CHIP8_LANES]; // Registers as V[register][lane], so one register of every lane is one vector
+    uint16_t PC[CHIP8_LANES];       // Program counter of each lane, an instance's own PC is only current while it runs
+    uint64_t divergent[CHIP8_XO_MEMORY_SIZE / 64]; // Bit n % 64 of word n / 64 is set when address n may hold different bytes in different lanes
+    uint32_t soa_stale;             // Bit n is set when lane n's chip8_t registers and PC are newer than V and PC
+    uint32_t aos_stale;             // Bit n is set when V is newer than lane n's chip8_t registers
+    uint64_t vector_steps;          // Lane instructions run as part of a vector
+    uint64_t scalar_steps;          // Lane instructions run through a lane's own instance
+} chip8_lanes_t;
+
+// Allocate count lanes (1 to CHIP8_LANES), each an instance with memory_size bytes of memory and the default configuration
+chip8_lanes_t *chip8_lanes_create(uint32_t count, uint32_t memory_size);
+
+// Free a lane group and its instances
+void chip8_lanes_destroy(chip8_lanes_t *lanes);
+
+// Instance of one lane with its registers up to date. It may be read or changed until the next chip8_lanes_step
+chip8_t *chip8_lanes_get(chip8_lanes_t *lanes, uint32_t lane);
+
+// Press or release a keypad key of one lane, without the resynchronization chip8_lanes_get costs
+void chip8_lanes_set_key(chip8_lanes_t *lanes, uint32_t lane, uint8_t key, bool pressed);
+
+// Emulate up to cycles instructions on each lane, a lane stops early after a draw if its display_wait is set.
+// Returns the number of instructions executed summed over all lanes
+uint64_t chip8_lanes_step(chip8_lanes_t *lanes, uint32_t cycles);
+
+// Decrement the timers of every lane, called at 60Hz
+void chip8_lanes_update_timers(chip8_lanes_t *lanes);
+
+#endif
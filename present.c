@@ -0,0 +1,42 @@
+#include <stdlib.h>
+#include <string.h>
+#include "present.h"
+#include "align.h"
+
+// Allocate an empty triple buffer
+chip8_present_t *chip8_present_create(void) {
+    chip8_present_t *present = chip8_aligned_calloc(_Alignof(chip8_present_t), sizeof *present);
+    if (present == NULL) {
+        return NULL;
+    }
+    atomic_init(&present->middle, 1);
+    present->back = 2;
+    return present;
+}
+
+// Free a triple buffer
+void chip8_present_destroy(chip8_present_t *present) {
+    chip8_aligned_free(present);
+}
+
+// Fill the back buffer and trade it for the middle one
+void chip8_present_publish(chip8_present_t *present, chip8_t *chip8) {
+    chip8_frame_t *frame = &present->frames[present->back];
+    memcpy(frame->display, chip8->display, sizeof frame->display);
+    frame->window_width = chip8->window_width;
+    frame->window_height = chip8->window_height;
+    frame->serial = present->published++;
+    chip8->dirty_rows = 0;
+    const uint32_t previous = atomic_exchange_explicit(&present->middle, present->back | PRESENT_FRESH, memory_order_acq_rel); // Release the frame, acquire the reader's old one
+    present->back = previous & ~PRESENT_FRESH;
+}
+
+// Trade the front buffer for the middle one if that holds a newer frame
+const chip8_frame_t *chip8_present_acquire(chip8_present_t *present) {
+    if ((atomic_load_explicit(&present->middle, memory_order_relaxed) & PRESENT_FRESH) == 0) {
+        return NULL;
+    }
+    const uint32_t fresh = atomic_exchange_explicit(&present->middle, present->front, memory_order_acq_rel);
+    present->front = fresh & ~PRESENT_FRESH;
+    return &present->frames[present->front];
+}
@@ -0,0 +1,44 @@
+#ifndef PRESENT_H
+#define PRESENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "chip8.h"
+
+// Display of one finished frame, as published for another thread to draw
+typedef struct {
+    uint64_t display[64][CHIP8_ROW_WORDS][CHIP8_PLANES]; // Copy of chip8->display, see chip8.h for the layout
+    uint32_t window_width;  // Resolution the frame was drawn at
+    uint32_t window_height;
+    uint64_t serial;        // Frames published before this one
+} chip8_frame_t;
+
+// Lock-free triple buffer between one thread publishing frames and one drawing them. The publisher always has a
+// buffer of its own to fill, and the reader always gets the newest finished frame without ever waiting for it.
+// Frames published faster than they are drawn are skipped
+typedef struct {
+    chip8_frame_t frames[3];
+    _Alignas(64) _Atomic uint32_t middle;   // Index of the frame handed over last, PRESENT_FRESH if not yet taken
+    _Alignas(64) uint32_t back;             // Frame being filled, owned by the publisher
+    uint64_t published;     // Frames published so far, owned by the publisher
+    _Alignas(64) uint32_t front;            // Frame being drawn, owned by the reader
+} chip8_present_t;
+
+#define PRESENT_FRESH 4     // Set in middle while the frame there is newer than the reader's
+
+// Allocate an empty triple buffer
+chip8_present_t *chip8_present_create(void);
+
+// Free a triple buffer once neither thread uses it
+void chip8_present_destroy(chip8_present_t *present);
+
+// Copy the display of chip8 into the back buffer and swap it into the middle. Called by the publishing thread only,
+// clears dirty_rows since the frame now holds every row
+void chip8_present_publish(chip8_present_t *present, chip8_t *chip8);
+
+// Newest frame published since the last call, or NULL if there is none. Called by the drawing thread only.
+// The frame stays valid until the next call
+const chip8_frame_t *chip8_present_acquire(chip8_present_t *present);
+
+#endif
@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+
+// Little-endian log layout:
+//   "C8IN", u16 version, u16 flags (bit 0 display_wait, bits 1-2 mode, bits 3-4 quirks), u64 seed, u64 FNV-1a hash of memory after loading
+//   then per frame u32 instructions and u16 keypad (bit n = key n). A frame of RESET_MARKER instructions
+//   means the ROM was reloaded before the next frame
+#define REPLAY_VERSION 2    // 2 added the quirk profile, version 1 logs would replay under whatever bits 3-4 hold
+#define REPLAY_HEADER 24
+#define REPLAY_FRAME 6
+#define RESET_MARKER 0xFFFFFFFF
+
+// Store value as size little-endian bytes
+static uint8_t *put_le(uint8_t *out, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        *out++ = value >> (8 * i);
+    }
+    return out;
+}
+
+// Read size little-endian bytes
+static uint64_t get_le(const uint8_t *in, size_t size) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+// FNV-1a hash of memory, to catch a log replayed on the wrong ROM
+static uint64_t memory_hash(const chip8_t *chip8) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < chip8->memory_size; i++) {
+        hash = (hash ^ chip8->memory[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// Start logging the run of chip8 to path
+chip8_replay_t *chip8_record_start(const chip8_t *chip8, const char path[]) {
+    chip8_replay_t *replay = calloc(1, sizeof *replay);
+    if (replay == NULL) {
+        return NULL;
+    }
+    replay->file = fopen(path, "wb");
+    if (replay->file == NULL) {
+        printf("Could not create input log: %s\n", path);
+        free(replay);
+        return NULL;
+    }
+    uint8_t header[REPLAY_HEADER];
+    uint8_t *out = header;
+    memcpy(out, "C8IN", 4);
+    out = put_le(out + 4, REPLAY_VERSION, 2);
+    out = put_le(out, chip8->display_wait | chip8->mode << 1 | chip8->quirks << 3, 2);
+    out = put_le(out, chip8->seed, 8);
+    put_le(out, memory_hash(chip8), 8);
+    if (fwrite(header, sizeof header, 1, replay->file) != 1) {
+        printf("Could not write input log: %s\n", path);
+        chip8_replay_close(replay);
+        return NULL;
+    }
+    return replay;
+}
+
+// Write one frame record
+static bool write_frame(chip8_replay_t *replay, uint32_t cycles, uint16_t keys) {
+    uint8_t record[REPLAY_FRAME];
+    put_le(put_le(record, cycles, 4), keys, 2);
+    return fwrite(record, sizeof record, 1, replay->file) == 1;
+}
+
+// Log the keypad and instruction budget of the frame about to run
+bool chip8_record_frame(chip8_replay_t *replay, const chip8_t *chip8, uint32_t cycles) {
+    uint16_t keys = 0;
+    for (uint8_t key = 0; key < 16; key++) {
+        keys |= chip8->keypad[key] << key;
+    }
+    replay->frames++;
+    return write_frame(replay, cycles, keys);
+}
+
+// Log that the ROM was reloaded
+bool chip8_record_reset(chip8_replay_t *replay) {
+    return write_frame(replay, RESET_MARKER, 0);
+}
+
+// Open a log for replay on chip8
+chip8_replay_t *chip8_replay_start(chip8_t *chip8, const char path[]) {
+    chip8_replay_t *replay = calloc(1, sizeof *replay);
+    if (replay == NULL) {
+        return NULL;
+    }
+    replay->file = fopen(path, "rb");
+    if (replay->file == NULL) {
+        printf("Could not open input log: %s\n", path);
+        free(replay);
+        return NULL;
+    }
+    uint8_t header[REPLAY_HEADER];
+    if (fread(header, sizeof header, 1, replay->file) != 1 || memcmp(header, "C8IN", 4) != 0) {
+        printf("Not an input log: %s\n", path);
+        chip8_replay_close(replay);
+        return NULL;
+    }
+    if (get_le(&header[4], 2) != REPLAY_VERSION) {
+        printf("Unsupported input log version %u: %s\n", (unsigned)get_le(&header[4], 2), path);
+        chip8_replay_close(replay);
+        return NULL;
+    }
+    if (get_le(&header[16], 8) != memory_hash(chip8)) {
+        printf("Input log was recorded on a different rom: %s\n", path);
+        chip8_replay_close(replay);
+        return NULL;
+    }
+    chip8_set_mode(chip8, get_le(&header[6], 2) >> 1 & 3);
+    chip8_set_quirks(chip8, get_le(&header[6], 2) >> 3 & 3);
+    chip8->display_wait = get_le(&header[6], 2) & 1;                                        // After the profile, which sets its own default
+    chip8_seed(chip8, get_le(&header[8], 8));
+    if (!chip8_take_snapshot(chip8)) {
+        chip8_replay_close(replay);
+        return NULL;
+    }
+    return replay;
+}
+
+// Set the keypad for the next recorded frame
+bool chip8_replay_frame(chip8_replay_t *replay, chip8_t *chip8, uint32_t *cycles) {
+    uint8_t record[REPLAY_FRAME];
+    for (;;) {
+        if (fread(record, sizeof record, 1, replay->file) != 1) {
+            return false;
+        }
+        *cycles = get_le(record, 4);
+        if (*cycles != RESET_MARKER) {
+            break;
+        }
+        chip8_restore_snapshot(chip8);                                                      // Same as reloading the rom, seed included
+    }
+    const uint16_t keys = get_le(&record[4], 2);
+    for (uint8_t key = 0; key < 16; key++) {
+        chip8_set_key(chip8, key, (keys >> key) & 1);
+    }
+    replay->frames++;
+    return true;
+}
+
+// Finish a recording or replay and free it
+void chip8_replay_close(chip8_replay_t *replay) {
+    if (replay != NULL) {
+        if (replay->file != NULL) {
+            fclose(replay->file);
+        }
+    }
+    free(replay);
+}
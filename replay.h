@@ -0,0 +1,36 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "chip8.h"
+
+// Input log of a run: the seed, platform and ROM it started from, then the instruction budget and keypad of every
+// frame. Replaying it on the same ROM reproduces the run exactly, at any speed
+typedef struct {
+    FILE *file;             // Log being written or read
+    uint64_t frames;        // Frames written or read so far
+} chip8_replay_t;
+
+// Start logging the run of chip8 to path. Call it right after the ROM is loaded, before any frame runs
+chip8_replay_t *chip8_record_start(const chip8_t *chip8, const char path[]);
+
+// Log the keypad and instruction budget of the frame about to run
+bool chip8_record_frame(chip8_replay_t *replay, const chip8_t *chip8, uint32_t cycles);
+
+// Log that the ROM was reloaded
+bool chip8_record_reset(chip8_replay_t *replay);
+
+// Open a log for replay on chip8, which must have just loaded the ROM it was recorded on.
+// Applies the recorded seed, display_wait, mode and quirks, and takes the snapshot reset markers restore
+chip8_replay_t *chip8_replay_start(chip8_t *chip8, const char path[]);
+
+// Set the keypad for the next recorded frame and its instruction budget in cycles. Returns false at the end of the log
+bool chip8_replay_frame(chip8_replay_t *replay, chip8_t *chip8, uint32_t *cycles);
+
+// Finish a recording or replay and free it
+void chip8_replay_close(chip8_replay_t *replay);
+
+#endif
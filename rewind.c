@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rewind.h"
+
+// A delta is a list of runs: u16 count of unchanged bytes, u16 count of changed bytes, then the
+// changed bytes XORed with the newer state. In the ring each delta sits between two copies of its
+// u32 length, so the oldest can be dropped from the front and the newest popped from the back
+#define RUN_MAX 0xFFFF
+
+// Allocate a history using capacity bytes for deltas
+chip8_rewind_t *chip8_rewind_create(const chip8_t *chip8, size_t capacity) {
+    if (capacity == 0) {
+        return NULL;
+    }
+    chip8_rewind_t *rewind = calloc(1, sizeof *rewind);
+    if (rewind == NULL) {
+        return NULL;
+    }
+    rewind->capacity = capacity;
+    rewind->state_size = chip8_state_size(chip8);
+    rewind->ring = malloc(capacity);
+    rewind->last = malloc(rewind->state_size);
+    rewind->current = malloc(rewind->state_size);
+    rewind->delta = malloc(rewind->state_size * 3);                                         // Worst case, alternating changed and unchanged bytes
+    if (rewind->ring == NULL || rewind->last == NULL || rewind->current == NULL || rewind->delta == NULL) {
+        chip8_rewind_destroy(rewind);
+        return NULL;
+    }
+    return rewind;
+}
+
+// Free a history
+void chip8_rewind_destroy(chip8_rewind_t *rewind) {
+    if (rewind != NULL) {
+        free(rewind->ring);
+        free(rewind->last);
+        free(rewind->current);
+        free(rewind->delta);
+    }
+    free(rewind);
+}
+
+// Copy bytes into the ring at offset, wrapping around its end
+static void ring_write(chip8_rewind_t *rewind, size_t offset, const uint8_t *bytes, size_t length) {
+    offset %= rewind->capacity;
+    const size_t first = length < rewind->capacity - offset ? length : rewind->capacity - offset;
+    memcpy(&rewind->ring[offset], bytes, first);
+    memcpy(rewind->ring, bytes + first, length - first);
+}
+
+// Copy bytes out of the ring at offset, wrapping around its end
+static void ring_read(const chip8_rewind_t *rewind, size_t offset, uint8_t *bytes, size_t length) {
+    offset %= rewind->capacity;
+    const size_t first = length < rewind->capacity - offset ? length : rewind->capacity - offset;
+    memcpy(bytes, &rewind->ring[offset], first);
+    memcpy(bytes + first, rewind->ring, length - first);
+}
+
+// Run-length encode newer XOR older into out, returning its length
+static size_t encode_delta(const uint8_t *older, const uint8_t *newer, size_t size, uint8_t *out) {
+    size_t length = 0;
+    size_t i = 0;
+    while (i < size) {
+        size_t same = 0;
+        while (i + same < size && same < RUN_MAX && newer[i + same] == older[i + same]) {
+            same++;
+        }
+        i += same;
+        size_t changed = 0;
+        while (i + changed < size && changed < RUN_MAX && newer[i + changed] != older[i + changed]) {
+            out[length + 4 + changed] = newer[i + changed] ^ older[i + changed];
+            changed++;
+        }
+        if (changed == 0 && i == size) {                                                    // Trailing unchanged bytes need no run
+            break;
+        }
+        out[length] = same;
+        out[length + 1] = same >> 8;
+        out[length + 2] = changed;
+        out[length + 3] = changed >> 8;
+        length += 4 + changed;
+        i += changed;
+    }
+    return length;
+}
+
+// XOR an encoded delta into state
+static void apply_delta(uint8_t *state, const uint8_t *delta, size_t length) {
+    size_t i = 0;
+    for (size_t at = 0; at < length;) {
+        const size_t same = delta[at] | delta[at + 1] << 8;
+        const size_t changed = delta[at + 2] | delta[at + 3] << 8;
+        at += 4;
+        i += same;
+        for (size_t j = 0; j < changed; j++) {
+            state[i++] ^= delta[at++];
+        }
+    }
+}
+
+// Drop the oldest delta
+static void drop_oldest(chip8_rewind_t *rewind) {
+    uint8_t bytes[4];
+    ring_read(rewind, rewind->head + rewind->capacity - rewind->used, bytes, sizeof bytes);
+    const size_t length = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (size_t)bytes[3] << 24;
+    rewind->used -= length + 8;
+    rewind->frames--;
+}
+
+// Record the state at the end of a frame
+void chip8_rewind_push(chip8_rewind_t *rewind, const chip8_t *chip8) {
+    chip8_save_state(chip8, rewind->current, rewind->state_size);
+    if (!rewind->has_last) {
+        memcpy(rewind->last, rewind->current, rewind->state_size);
+        rewind->has_last = true;
+        return;
+    }
+    const size_t length = encode_delta(rewind->last, rewind->current, rewind->state_size, rewind->delta);
+    uint8_t *swap = rewind->last;                                                           // The pushed state becomes the newest
+    rewind->last = rewind->current;
+    rewind->current = swap;
+    if (length + 8 > rewind->capacity) {                                                    // Could never fit, the older frames are unreachable now
+        rewind->used = 0;
+        rewind->frames = 0;
+        return;
+    }
+    while (rewind->used + length + 8 > rewind->capacity) {
+        drop_oldest(rewind);
+    }
+    const uint8_t size[4] = {length, length >> 8, length >> 16, length >> 24};
+    ring_write(rewind, rewind->head, size, sizeof size);
+    ring_write(rewind, rewind->head + 4, rewind->delta, length);
+    ring_write(rewind, rewind->head + 4 + length, size, sizeof size);
+    rewind->head = (rewind->head + length + 8) % rewind->capacity;
+    rewind->used += length + 8;
+    rewind->frames++;
+}
+
+// Restore the frame recorded before the newest one
+bool chip8_rewind_step(chip8_rewind_t *rewind, chip8_t *chip8) {
+    if (rewind->frames == 0) {
+        return false;
+    }
+    uint8_t size[4];
+    ring_read(rewind, rewind->head + rewind->capacity - 4, size, sizeof size);
+    const size_t length = size[0] | size[1] << 8 | size[2] << 16 | (size_t)size[3] << 24;
+    ring_read(rewind, rewind->head + rewind->capacity - 4 - length, rewind->delta, length);
+    apply_delta(rewind->last, rewind->delta, length);
+    rewind->head = (rewind->head + rewind->capacity - length - 8) % rewind->capacity;
+    rewind->used -= length + 8;
+    rewind->frames--;
+    return chip8_load_state(chip8, rewind->last, rewind->state_size);
+}
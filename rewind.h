@@ -0,0 +1,36 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "chip8.h"
+
+// Per-frame history of an instance in a fixed amount of memory. Each frame is kept as the XOR of its
+// save state with the next one, run-length encoded, so frames that change little cost a few dozen bytes
+typedef struct {
+    uint8_t *ring;          // Encoded deltas, oldest first, wrapping around at capacity
+    size_t capacity;        // Size of ring in bytes
+    size_t head;            // Offset one past the newest delta
+    size_t used;            // Bytes of ring in use, the oldest delta starts used bytes before head
+    uint32_t frames;        // Deltas held, i.e. how many frames can be rewound
+    size_t state_size;      // Size of a save state of the instance
+    uint8_t *last;          // Save state of the newest frame pushed
+    uint8_t *current;       // Save state being pushed
+    uint8_t *delta;         // Encoded delta being pushed or popped
+    bool has_last;          // Whether a frame has been pushed since creation
+} chip8_rewind_t;
+
+// Allocate a history for chip8 using capacity bytes for deltas
+chip8_rewind_t *chip8_rewind_create(const chip8_t *chip8, size_t capacity);
+
+// Free a history
+void chip8_rewind_destroy(chip8_rewind_t *rewind);
+
+// Record the state at the end of a frame, dropping the oldest frames once the ring is full
+void chip8_rewind_push(chip8_rewind_t *rewind, const chip8_t *chip8);
+
+// Restore the frame recorded before the newest one and make it the newest. Fails when there is none
+bool chip8_rewind_step(chip8_rewind_t *rewind, chip8_t *chip8);
+
+#endif
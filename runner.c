@@ -0,0 +1,328 @@
+#define _POSIX_C_SOURCE 200809L                                                        // clock_gettime and sysconf
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "chip8.h"
+#include "corpus.h"
+
+// One ROM under one configuration, run to completion by whichever worker gets it
+typedef struct {
+    const chip8_corpus_rom_t *rom; // ROM image in the corpus mapping, shared read-only by every task using it
+    quirks_t quirks;        // Quirk profile this task runs under, QUIRKS_COUNT for the one of the ROM's corpus entry
+    bool display_wait;
+    uint64_t instructions;  // Instructions executed, filled in by the worker
+    uint64_t hash;          // Hash of the final machine state, filled in by the worker
+    bool failed;            // The instance could not be created or loaded
+} task_t;
+
+// Task indices owned by one worker. The owner pops from the bottom, thieves take from the top
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t *tasks;        // Indices into the task list
+    uint32_t top;           // Oldest task not yet taken
+    uint32_t bottom;        // One past the newest task
+} deque_t;
+
+typedef struct {
+    task_t *tasks;          // Every task of the run
+    deque_t *deques;        // One deque per worker
+    uint32_t workers;       // Number of worker threads
+    engine_t engine;        // Interpreter loop every instance uses
+    uint32_t instructions_per_frame; // 0 keeps the default emulation rate
+    uint64_t frame_limit;   // Frames each task runs for
+} pool_t;
+
+typedef struct {
+    pool_t *pool;
+    uint32_t id;            // Index of this worker's own deque
+    uint32_t completed;     // Tasks this worker ran
+    uint32_t stolen;        // Of those, tasks taken from another worker's deque
+} worker_t;
+
+// Take the newest task of the worker's own deque
+bool pop_task(deque_t *deque, uint32_t *task) {
+    bool found = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->top < deque->bottom) {
+        *task = deque->tasks[--deque->bottom];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// Take the oldest task of another worker's deque
+bool steal_task(deque_t *deque, uint32_t *task) {
+    bool found = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->top < deque->bottom) {
+        *task = deque->tasks[deque->top++];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// Run one task on a fresh instance owned by the calling worker, under the ROM's own platform
+void run_task(const pool_t *pool, task_t *task) {
+    chip8_t *chip8 = chip8_create_with_memory(task->rom->mode == MODE_XOCHIP ? CHIP8_XO_MEMORY_SIZE : CHIP8_MEMORY_SIZE);
+    if (chip8 == NULL || !chip8_corpus_load(chip8, task->rom)) {
+        task->failed = true;
+        chip8_destroy(chip8);
+        return;
+    }
+    chip8->engine = pool->engine;
+    if (task->quirks != QUIRKS_COUNT) {
+        chip8_set_quirks(chip8, task->quirks);
+    }
+    chip8->display_wait = task->display_wait;                                               // After the profile, which sets its own default
+    if (pool->instructions_per_frame != 0) {
+        chip8->emulation_rate = pool->instructions_per_frame * 60;
+    }
+    uint64_t frame = 0;
+    for (; frame < pool->frame_limit && !chip8->halted; frame++) {
+        task->instructions += chip8_step(chip8, chip8_frame_cycles(chip8));
+        chip8_update_timers(chip8);
+    }
+    uint64_t cycles = 0;
+    for (; frame < pool->frame_limit; frame++) {                                            // A halted ROM reads no timers or keys, so the rest can run as one step
+        cycles += chip8_frame_cycles(chip8);
+        chip8_update_timers(chip8);
+    }
+    while (cycles > 0) {
+        const uint32_t budget = cycles < UINT32_MAX ? cycles : UINT32_MAX;
+        task->instructions += chip8_step(chip8, budget);
+        cycles -= budget;
+    }
+    task->hash = chip8_state_hash(chip8);
+    chip8_destroy(chip8);
+}
+
+// Drain the worker's own deque, then steal from the others until every deque is empty
+void *worker_main(void *arg) {
+    worker_t *worker = arg;
+    pool_t *pool = worker->pool;
+    uint32_t task;
+    for (;;) {
+        if (pop_task(&pool->deques[worker->id], &task)) {
+            run_task(pool, &pool->tasks[task]);
+            worker->completed++;
+            continue;
+        }
+        bool found = false;
+        for (uint32_t i = 1; !found && i < pool->workers; i++) {                            // No task spawns more tasks, so empty deques stay empty
+            found = steal_task(&pool->deques[(worker->id + i) % pool->workers], &task);
+        }
+        if (!found) {
+            return NULL;
+        }
+        run_task(pool, &pool->tasks[task]);
+        worker->completed++;
+        worker->stolen++;
+    }
+}
+
+// Mark the profiles of a comma separated --quirks value: profile names, "rom" for each ROM's own or "all"
+bool parse_quirks(const char *list, bool profiles[QUIRKS_COUNT + 1]) {
+    memset(profiles, 0, (QUIRKS_COUNT + 1) * sizeof *profiles);
+    for (const char *name = list; *name != '\0';) {
+        const size_t length = strcspn(name, ",");
+        bool known = false;
+        if (length == 3 && strncmp(name, "all", 3) == 0) {
+            for (quirks_t i = 0; i < QUIRKS_COUNT; i++) {
+                profiles[i] = true;
+            }
+            known = true;
+        }
+        else if (length == 3 && strncmp(name, "rom", 3) == 0) {
+            profiles[QUIRKS_COUNT] = true;
+            known = true;
+        }
+        for (quirks_t i = 0; !known && length > 0 && i < QUIRKS_COUNT; i++) {
+            if (strncmp(name, chip8_quirks_name(i), length) == 0) {
+                profiles[i] = true;
+                known = true;                                                               // "schip" picks the first SuperChip profile
+            }
+        }
+        if (!known) {
+            printf("Unknown quirk profile: %.*s\n", (int)length, name);
+            return false;
+        }
+        name += name[length] == ',' ? length + 1 : length;
+    }
+    return true;
+}
+
+// Main
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s [-j threads] [--frames N] [--engine cached|threaded|block] [--ipf N] [--quirks rom|all|PROFILE,...] [--display-wait on|off|both] [--index] [--pack file] rom|directory|corpus...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    pool_t pool = {.workers = online > 0 ? online : 1, .engine = CHIP8_ENGINE, .frame_limit = 600};
+    bool wait_modes[2] = {false, true};                                                     // Indexed by display_wait, which configurations to run
+    bool profiles[QUIRKS_COUNT + 1] = {[QUIRKS_COUNT] = true};                              // Indexed by quirks_t, QUIRKS_COUNT for each ROM's own profile
+    bool print_index = false;
+    const char *pack_file = NULL;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {                                      // Options come before the rom names
+        if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            pool.workers = strtoul(argv[++arg], NULL, 0);
+            if (pool.workers == 0) {
+                pool.workers = 1;
+            }
+        }
+        else if (strcmp(argv[arg], "--frames") == 0 && arg + 1 < argc) {
+            pool.frame_limit = strtoull(argv[++arg], NULL, 0);
+        }
+        else if (strcmp(argv[arg], "--engine") == 0 && arg + 1 < argc) {
+            pool.engine = ENGINE_COUNT;
+            arg++;
+            for (engine_t i = 0; i < ENGINE_COUNT; i++) {
+                if (strncmp(argv[arg], chip8_engine_name(i), strlen(argv[arg])) == 0) {
+                    pool.engine = i;
+                }
+            }
+            if (pool.engine == ENGINE_COUNT) {
+                printf("Unknown engine: %s\n", argv[arg]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[arg], "--ipf") == 0 && arg + 1 < argc) {
+            pool.instructions_per_frame = strtoul(argv[++arg], NULL, 0);
+        }
+        else if (strcmp(argv[arg], "--quirks") == 0 && arg + 1 < argc) {
+            if (!parse_quirks(argv[++arg], profiles)) {
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[arg], "--display-wait") == 0 && arg + 1 < argc) {
+            arg++;
+            wait_modes[false] = strcmp(argv[arg], "off") == 0 || strcmp(argv[arg], "both") == 0;
+            wait_modes[true] = strcmp(argv[arg], "on") == 0 || strcmp(argv[arg], "both") == 0;
+            if (!wait_modes[false] && !wait_modes[true]) {
+                printf("Unknown display wait mode: %s\n", argv[arg]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[arg], "--index") == 0) {
+            print_index = true;
+        }
+        else if (strcmp(argv[arg], "--pack") == 0 && arg + 1 < argc) {
+            pack_file = argv[++arg];
+        }
+        else {
+            printf("Unknown option: %s\n", argv[arg]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Every rom is mapped once up front and shared by the tasks that run it
+    chip8_corpus_t *corpus = chip8_corpus_create();
+    if (corpus == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    for (; arg < argc; arg++) {
+        if (!chip8_corpus_add(corpus, argv[arg])) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (corpus->count == 0) {
+        printf("No roms given\n");
+        exit(EXIT_FAILURE);
+    }
+    if (print_index || pack_file != NULL) {                                                 // Index or pack the corpus instead of running it
+        for (uint32_t i = 0; print_index && i < corpus->count; i++) {
+            char sha1[41];
+            chip8_corpus_sha1_hex(&corpus->roms[i], sha1);
+            printf("%s sha1=%s size=%zu mode=%s quirks=%s\n", corpus->roms[i].name, sha1, corpus->roms[i].size, chip8_mode_name(corpus->roms[i].mode), chip8_quirks_name(corpus->roms[i].quirks));
+        }
+        const bool packed = pack_file == NULL || chip8_corpus_pack(corpus, pack_file);
+        chip8_corpus_destroy(corpus);
+        exit(packed ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    pool.tasks = calloc(corpus->count * (QUIRKS_COUNT + 1) * 2, sizeof *pool.tasks);
+    if (pool.tasks == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    uint32_t task_count = 0;
+    for (uint32_t i = 0; i < corpus->count; i++) {                                          // The ROM's own profile first, then the listed ones in order
+        for (uint32_t n = 0; n <= QUIRKS_COUNT; n++) {
+            const quirks_t quirks = (n + QUIRKS_COUNT) % (QUIRKS_COUNT + 1);                // QUIRKS_COUNT, then 0 onwards
+            for (int wait = 1; wait >= 0; wait--) {
+                if (profiles[quirks] && wait_modes[wait]) {
+                    pool.tasks[task_count++] = (task_t) {.rom = &corpus->roms[i], .quirks = quirks, .display_wait = wait};
+                }
+            }
+        }
+    }
+    if (pool.workers > task_count) {
+        pool.workers = task_count;
+    }
+    // Deal the tasks out round-robin, stealing evens out whatever the ROMs make uneven
+    pool.deques = calloc(pool.workers, sizeof *pool.deques);
+    worker_t *workers = calloc(pool.workers, sizeof *workers);
+    pthread_t *threads = calloc(pool.workers, sizeof *threads);
+    if (pool.deques == NULL || workers == NULL || threads == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < pool.workers; i++) {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].tasks = calloc(task_count / pool.workers + 1, sizeof *pool.deques[i].tasks);
+        if (pool.deques[i].tasks == NULL) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (uint32_t i = 0; i < task_count; i++) {
+        deque_t *deque = &pool.deques[i % pool.workers];
+        deque->tasks[deque->bottom++] = task_count - 1 - i;                                 // Owners pop from the bottom, so the first tasks run first
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < pool.workers; i++) {
+        workers[i] = (worker_t) {.pool = &pool, .id = i};
+        if (pthread_create(&threads[i], NULL, worker_main, &workers[i]) != 0) {
+            printf("Could not start worker thread %u\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (uint32_t i = 0; i < pool.workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    // Results are printed in task order, not completion order, so runs can be diffed
+    uint64_t instructions = 0;
+    bool failed = false;
+    for (uint32_t i = 0; i < task_count; i++) {
+        const task_t *task = &pool.tasks[i];
+        const quirks_t quirks = task->quirks != QUIRKS_COUNT ? task->quirks : task->rom->quirks;
+        if (task->failed) {
+            printf("%s quirks=%s display_wait=%s FAILED\n", task->rom->name, chip8_quirks_name(quirks), task->display_wait ? "on" : "off");
+            failed = true;
+            continue;
+        }
+        printf("%s quirks=%s display_wait=%s instructions=%llu hash=%016llX\n", task->rom->name, chip8_quirks_name(quirks), task->display_wait ? "on" : "off", (unsigned long long)task->instructions, (unsigned long long)task->hash);
+        instructions += task->instructions;
+    }
+    uint32_t stolen = 0;
+    for (uint32_t i = 0; i < pool.workers; i++) {
+        stolen += workers[i].stolen;
+    }
+    fprintf(stderr, "%s: %u tasks on %u threads (%u stolen), %llu instructions in %.3f s (%.2f MIPS)\n", chip8_engine_name(pool.engine), task_count, pool.workers, stolen, (unsigned long long)instructions, seconds, seconds > 0 ? instructions / seconds / 1e6 : 0.0);
+    for (uint32_t i = 0; i < pool.workers; i++) {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].tasks);
+    }
+    free(threads);
+    free(workers);
+    free(pool.deques);
+    free(pool.tasks);
+    chip8_corpus_destroy(corpus);
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,543 @@
+#define _POSIX_C_SOURCE 200809L                                                        // clock_gettime, strncasecmp and sockets
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "chip8.h"
+#include "corpus.h"
+
+// Binary WebSocket messages, little-endian.
+// Server to client, MESSAGE_FRAME after every frame that changed something a client has not been sent:
+//   u8 type, u8 FRAME_* flags, u8 row count, u8 reserved, u32 frame number,
+//   then per row u8 y and the row of each plane (one, or two with FRAME_PLANES), width / 8 bytes, leftmost pixel in the top bit
+// Server to client, MESSAGE_AUDIO on connecting and whenever the XO-Chip pattern or pitch changes:
+//   u8 type, u8 pitch, u8 pattern set, u8 reserved, 16 bytes of pattern
+// Client to server: u8 MESSAGE_KEY, u8 key, u8 pressed, or u8 MESSAGE_RESET
+#define MESSAGE_FRAME 1
+#define MESSAGE_AUDIO 2
+#define MESSAGE_KEY 1
+#define MESSAGE_RESET 2
+#define FRAME_HIRES 1       // 128x64, otherwise 64x32
+#define FRAME_SOUND 2       // The sound timer is running
+#define FRAME_PLANES 4      // Rows carry both XO-Chip planes
+#define FRAME_HEADER 8
+
+#define MAX_CLIENTS 256
+#define REQUEST_BYTES 4096  // Longest HTTP request accepted before the upgrade
+#define INPUT_BYTES 256     // Room for a partly received message, client messages are at most 125 bytes
+#define OUTPUT_BYTES 16384  // Output queued per client. A client this far behind gets no frames until it drains, its rows pile up as pending instead
+#define FRAME_NS 16666667   // 60Hz
+#define MAX_CATCH_UP 4      // Frames run back to back after a stall before the rest are dropped
+
+// One instance and what its clients were last sent as a whole
+typedef struct {
+    chip8_t *chip8;
+    const chip8_corpus_rom_t *rom;
+    uint64_t shown[64][CHIP8_ROW_WORDS][CHIP8_PLANES]; // Display at the end of the last frame
+    uint32_t shown_width;   // Resolution of shown
+    uint64_t changed;       // Bit n: row n changed in the last frame
+    bool audio_changed;     // The pattern or pitch changed in the last frame
+} session_t;
+
+// A browser connection, first an HTTP request, then a WebSocket attached to one session
+typedef struct {
+    int fd;
+    bool upgraded;          // The WebSocket handshake is done and frames flow
+    bool closing;           // Close once the output is sent
+    uint32_t session;       // Index of the session watched
+    uint64_t pending;       // Bit n: row n changed since the client was last sent it
+    uint32_t width;         // Resolution the client last got, 0 before the first frame
+    bool sound;             // Sound state the client last got
+    bool audio_pending;     // The pattern or pitch has to be sent
+    size_t request_length;
+    char request[REQUEST_BYTES];
+    size_t input_length;
+    uint8_t input[INPUT_BYTES];
+    size_t output_length;
+    uint8_t output[OUTPUT_BYTES];
+} client_t;
+
+typedef struct {
+    int listener;
+    session_t *sessions;
+    uint32_t session_count;
+    client_t *clients[MAX_CLIENTS];
+    uint32_t client_count;
+    uint64_t frames;        // Frames run since the start
+} server_t;
+
+// Page served for anything but a WebSocket upgrade: watches the session named in the URL fragment (#3), keys as in the frontend
+static const char viewer_page[] =
+    "<!doctype html><title>Chipette</title><body style=\"background:#141414;margin:0\">"
+    "<canvas id=c width=64 height=32 style=\"width:100vw;height:50vw;image-rendering:pixelated\"></canvas><script>\n"
+    "const ws = new WebSocket(`ws://${location.host}/${location.hash.slice(1) || 0}`); ws.binaryType = 'arraybuffer';\n"
+    "const canvas = document.getElementById('c'), context = canvas.getContext('2d'), image = context.createImageData(128, 64);\n"
+    "const colors = [[20, 20, 20], [200, 200, 200], [110, 110, 110], [245, 245, 245]], keys = '1234qwerasdfzxcv', values = [1, 2, 3, 12, 4, 5, 6, 13, 7, 8, 9, 14, 10, 0, 11, 15];\n"
+    "let audio = null, gain = null;\n"
+    "ws.onmessage = event => {\n"
+    "  const data = new Uint8Array(event.data);\n"
+    "  if (data[0] != 1) return;\n"
+    "  const width = data[1] & 1 ? 128 : 64, planes = data[1] & 4 ? 2 : 1, bytes = width / 8;\n"
+    "  if (canvas.width != width) { canvas.width = width; canvas.height = width / 2; }\n"
+    "  for (let row = 0, at = 8; row < data[2]; row++, at += 1 + planes * bytes) {\n"
+    "    const y = data[at];\n"
+    "    for (let x = 0; x < width; x++) {\n"
+    "      let color = 0;\n"
+    "      for (let plane = 0; plane < planes; plane++) color |= (data[at + 1 + plane * bytes + (x >> 3)] >> (7 - (x & 7)) & 1) << plane;\n"
+    "      image.data.set([...colors[color], 255], (y * 128 + x) * 4);\n"
+    "    }\n"
+    "  }\n"
+    "  context.putImageData(image, 0, 0);\n"
+    "  if (gain) gain.gain.value = data[1] & 2 ? 0.1 : 0;\n"
+    "};\n"
+    "const send = (event, pressed) => {\n"
+    "  if (!audio) { audio = new AudioContext(); const tone = audio.createOscillator(); gain = audio.createGain(); gain.gain.value = 0; tone.type = 'square'; tone.frequency.value = 600; tone.connect(gain).connect(audio.destination); tone.start(); }\n"
+    "  const key = keys.indexOf(event.key.toLowerCase());\n"
+    "  if (key >= 0 && !event.repeat && ws.readyState == 1) ws.send(new Uint8Array([1, values[key], pressed]));\n"
+    "};\n"
+    "addEventListener('keydown', event => send(event, 1)); addEventListener('keyup', event => send(event, 0));\n"
+    "</script>\n";
+
+// Current time in nanoseconds, for the frame schedule
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Base64 of size bytes of data into out, which holds 4 * ((size + 2) / 3) + 1 characters
+static void base64(const uint8_t *data, size_t size, char *out) {
+    const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (size_t i = 0; i < size; i += 3) {
+        const uint32_t group = data[i] << 16 | (i + 1 < size ? data[i + 1] << 8 : 0) | (i + 2 < size ? data[i + 2] : 0);
+        *out++ = digits[(group >> 18) & 63];
+        *out++ = digits[(group >> 12) & 63];
+        *out++ = i + 1 < size ? digits[(group >> 6) & 63] : '=';
+        *out++ = i + 2 < size ? digits[group & 63] : '=';
+    }
+    *out = '\0';
+}
+
+// Queue raw bytes for the client. False if they don't fit, nothing is queued then
+static bool queue_bytes(client_t *client, const void *data, size_t size) {
+    if (client->output_length + size > sizeof client->output) {
+        return false;
+    }
+    memcpy(&client->output[client->output_length], data, size);
+    client->output_length += size;
+    return true;
+}
+
+// Queue payload as one binary WebSocket message. Servers don't mask
+static bool queue_message(client_t *client, const uint8_t *payload, size_t size) {
+    uint8_t header[4] = {0x82, size};                                                       // FIN, binary
+    size_t header_size = 2;
+    if (size >= 126) {
+        header[1] = 126;
+        header[2] = size >> 8;
+        header[3] = size;
+        header_size = 4;
+    }
+    if (client->output_length + header_size + size > sizeof client->output) {
+        return false;
+    }
+    queue_bytes(client, header, header_size);
+    return queue_bytes(client, payload, size);
+}
+
+// Send as much queued output as the socket takes. False if the connection is gone
+static bool flush_output(client_t *client) {
+    size_t sent = 0;
+    while (sent < client->output_length) {
+        const ssize_t count = send(client->fd, &client->output[sent], client->output_length - sent, 0);
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        sent += count;
+    }
+    memmove(client->output, &client->output[sent], client->output_length - sent);
+    client->output_length -= sent;
+    return !(client->closing && client->output_length == 0);
+}
+
+// Queue the rows the client has pending and its sound state, if the message fits
+static void queue_frame(const server_t *server, client_t *client) {
+    const session_t *session = &server->sessions[client->session];
+    const chip8_t *chip8 = session->chip8;
+    const bool sound = chip8->sound_timer > 0;
+    if (client->audio_pending) {
+        uint8_t audio[4 + sizeof chip8->audio_pattern] = {MESSAGE_AUDIO, chip8->pitch, chip8->audio_pattern_set};
+        memcpy(&audio[4], chip8->audio_pattern, sizeof chip8->audio_pattern);
+        if (!queue_message(client, audio, sizeof audio)) {
+            return;
+        }
+        client->audio_pending = false;
+    }
+    if (client->width != session->shown_width) {
+        client->pending = ~0ull;
+    }
+    client->pending &= session->shown_width == 128 ? ~0ull : 0xFFFFFFFFull;                 // Low resolution only has 32 rows
+    if (client->pending == 0 && client->sound == sound) {
+        return;
+    }
+    const uint32_t planes = chip8->mode == MODE_XOCHIP ? 2 : 1;
+    const uint32_t bytes = session->shown_width / 8;
+    uint8_t message[FRAME_HEADER + 64 * (1 + 2 * 16)];
+    uint8_t *out = &message[FRAME_HEADER];
+    uint32_t rows = 0;
+    for (uint64_t pending = client->pending; pending != 0; pending &= pending - 1) {
+        const uint32_t y = __builtin_ctzll(pending);
+        *out++ = y;
+        for (uint32_t plane = 0; plane < planes; plane++) {
+            for (uint32_t i = 0; i < bytes; i++) {
+                *out++ = session->shown[y][i / 8][plane] >> (56 - 8 * (i % 8));
+            }
+        }
+        rows++;
+    }
+    message[0] = MESSAGE_FRAME;
+    message[1] = (session->shown_width == 128 ? FRAME_HIRES : 0) | (sound ? FRAME_SOUND : 0) | (planes == 2 ? FRAME_PLANES : 0);
+    message[2] = rows;
+    message[3] = 0;
+    for (uint32_t i = 0; i < 4; i++) {
+        message[4 + i] = server->frames >> (8 * i);
+    }
+    if (queue_message(client, message, out - message)) {
+        client->pending = 0;
+        client->width = session->shown_width;
+        client->sound = sound;
+    }
+}
+
+// Act on one message from a client
+static void handle_message(server_t *server, client_t *client, const uint8_t *payload, size_t size) {
+    chip8_t *chip8 = server->sessions[client->session].chip8;
+    if (size == 3 && payload[0] == MESSAGE_KEY) {
+        chip8_set_key(chip8, payload[1], payload[2] != 0);
+    }
+    else if (size == 1 && payload[0] == MESSAGE_RESET) {
+        chip8_restore_snapshot(chip8);
+    }
+}
+
+// Take every complete WebSocket frame out of the client's input. False if it closed or broke the protocol
+static bool read_messages(server_t *server, client_t *client) {
+    size_t offset = 0;
+    while (client->input_length - offset >= 2) {
+        const uint8_t *frame = &client->input[offset];
+        const uint8_t opcode = frame[0] & 0x0F;
+        const size_t size = frame[1] & 0x7F;
+        if ((frame[1] & 0x80) == 0 || size > 125) {                                         // Clients must mask, and have nothing long to say
+            return false;
+        }
+        if (client->input_length - offset < 6 + size) {
+            break;
+        }
+        uint8_t payload[125];
+        for (size_t i = 0; i < size; i++) {
+            payload[i] = frame[6 + i] ^ frame[2 + (i & 3)];
+        }
+        offset += 6 + size;
+        if (opcode == 0x8) {                                                                // Close
+            return false;
+        }
+        if (opcode == 0x2) {
+            handle_message(server, client, payload, size);
+        }
+    }
+    memmove(client->input, &client->input[offset], client->input_length - offset);
+    client->input_length -= offset;
+    return true;
+}
+
+// Answer a complete HTTP request: the WebSocket handshake for GET /N with a Sec-WebSocket-Key, the viewer page otherwise
+static bool handle_request(server_t *server, client_t *client) {
+    char *end = strstr(client->request, "\r\n\r\n");
+    unsigned session = 0;
+    sscanf(client->request, "GET /%u", &session);
+    const char *key = NULL;
+    size_t key_length = 0;
+    for (char *line = strstr(client->request, "\r\n"); line != NULL && line < end; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Sec-WebSocket-Key:", 18) == 0) {
+            key = line + 2 + 18;
+            key += strspn(key, " \t");
+            key_length = strcspn(key, " \t\r");
+        }
+    }
+    char response[512];
+    if (key == NULL || key_length > 64) {
+        snprintf(response, sizeof response, "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", sizeof viewer_page - 1);
+        client->closing = true;
+        return queue_bytes(client, response, strlen(response)) && queue_bytes(client, viewer_page, sizeof viewer_page - 1);
+    }
+    if (session >= server->session_count) {
+        snprintf(response, sizeof response, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        client->closing = true;
+        return queue_bytes(client, response, strlen(response));
+    }
+    char accept_input[64 + 36];
+    memcpy(accept_input, key, key_length);
+    memcpy(&accept_input[key_length], "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", 36);
+    uint8_t digest[20];
+    chip8_sha1((const uint8_t *)accept_input, key_length + 36, digest);
+    char accept[29];
+    base64(digest, sizeof digest, accept);
+    snprintf(response, sizeof response, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+    client->upgraded = true;
+    client->session = session;
+    client->pending = ~0ull;                                                                // A new viewer needs every row and the sound state
+    client->audio_pending = true;
+    const size_t body = end + 4 - client->request;                                          // Messages sent right behind the request
+    client->input_length = client->request_length - body;
+    if (client->input_length > sizeof client->input) {
+        return false;
+    }
+    memcpy(client->input, &client->request[body], client->input_length);
+    return queue_bytes(client, response, strlen(response)) && read_messages(server, client);
+}
+
+// Read what the client sent. False if the connection is gone or broke the protocol
+static bool read_client(server_t *server, client_t *client) {
+    char *into = client->upgraded ? (char *)&client->input[client->input_length] : &client->request[client->request_length];
+    const size_t room = client->upgraded ? sizeof client->input - client->input_length : sizeof client->request - 1 - client->request_length;
+    if (room == 0) {
+        return false;
+    }
+    const ssize_t count = recv(client->fd, into, room, 0);
+    if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return true;
+    }
+    if (count <= 0) {
+        return false;
+    }
+    if (client->upgraded) {
+        client->input_length += count;
+        return read_messages(server, client);
+    }
+    client->request_length += count;
+    client->request[client->request_length] = '\0';
+    if (client->closing || strstr(client->request, "\r\n\r\n") == NULL) {
+        return true;
+    }
+    return handle_request(server, client);
+}
+
+// Accept every waiting connection
+static void accept_clients(server_t *server) {
+    for (;;) {
+        const int fd = accept(server->listener, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        client_t *client = server->client_count < MAX_CLIENTS ? calloc(1, sizeof *client) : NULL;
+        if (client == NULL) {
+            close(fd);
+            continue;
+        }
+        const int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);                          // Frames are small and late ones are useless
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        client->fd = fd;
+        server->clients[server->client_count++] = client;
+    }
+}
+
+// Close a client, moving the last one into its slot
+static void drop_client(server_t *server, uint32_t index) {
+    close(server->clients[index]->fd);
+    free(server->clients[index]);
+    server->clients[index] = server->clients[--server->client_count];
+}
+
+// Run one frame of a session and find the rows it really changed
+static void run_session(session_t *session) {
+    chip8_t *chip8 = session->chip8;
+    const uint8_t pitch = chip8->pitch;
+    const bool pattern_set = chip8->audio_pattern_set;
+    uint8_t pattern[sizeof chip8->audio_pattern];
+    memcpy(pattern, chip8->audio_pattern, sizeof pattern);
+    chip8_step(chip8, chip8_frame_cycles(chip8));
+    chip8_update_timers(chip8);
+    session->audio_changed = pitch != chip8->pitch || pattern_set != chip8->audio_pattern_set || memcmp(pattern, chip8->audio_pattern, sizeof pattern) != 0;
+    session->changed = 0;
+    const bool resized = chip8->window_width != session->shown_width;
+    for (uint64_t dirty = resized ? ~0ull : chip8->dirty_rows; dirty != 0; dirty &= dirty - 1) {
+        const uint32_t y = __builtin_ctzll(dirty);
+        if (memcmp(session->shown[y], chip8->display[y], sizeof session->shown[y]) != 0) {
+            memcpy(session->shown[y], chip8->display[y], sizeof session->shown[y]);
+            session->changed |= 1ull << y;
+        }
+    }
+    chip8->dirty_rows = 0;
+    session->shown_width = chip8->window_width;
+}
+
+// Run every session one frame and queue what changed for its clients
+static void run_frame(server_t *server) {
+    for (uint32_t i = 0; i < server->session_count; i++) {
+        run_session(&server->sessions[i]);
+    }
+    server->frames++;
+    for (uint32_t i = 0; i < server->client_count; i++) {
+        client_t *client = server->clients[i];
+        if (client->upgraded) {
+            client->pending |= server->sessions[client->session].changed;
+            client->audio_pending |= server->sessions[client->session].audio_changed;
+            queue_frame(server, client);
+        }
+    }
+}
+
+// Listen for connections on every interface
+static int listen_on(uint16_t port) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_ANY)};
+    if (bind(fd, (struct sockaddr *)&address, sizeof address) != 0 || listen(fd, 64) != 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// Main
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s [--port N] [--sessions N] [--ipf N] [--frames N] rom|directory|corpus...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    uint16_t port = 8008;
+    uint32_t session_count = 0;                                                             // 0 runs every ROM given once
+    uint32_t instructions_per_frame = 0;
+    uint64_t frame_limit = 0;                                                               // 0 serves until killed
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {                                      // Options come before the rom names
+        if (strcmp(argv[arg], "--port") == 0 && arg + 1 < argc) {
+            port = strtoul(argv[++arg], NULL, 0);
+        }
+        else if (strcmp(argv[arg], "--sessions") == 0 && arg + 1 < argc) {
+            session_count = strtoul(argv[++arg], NULL, 0);
+        }
+        else if (strcmp(argv[arg], "--ipf") == 0 && arg + 1 < argc) {
+            instructions_per_frame = strtoul(argv[++arg], NULL, 0);
+        }
+        else if (strcmp(argv[arg], "--frames") == 0 && arg + 1 < argc) {
+            frame_limit = strtoull(argv[++arg], NULL, 0);
+        }
+        else {
+            printf("Unknown option: %s\n", argv[arg]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    chip8_corpus_t *corpus = chip8_corpus_create();
+    if (corpus == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    for (; arg < argc; arg++) {
+        if (!chip8_corpus_add(corpus, argv[arg])) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (corpus->count == 0) {
+        printf("No roms given\n");
+        exit(EXIT_FAILURE);
+    }
+    server_t server = {.session_count = session_count != 0 ? session_count : corpus->count};
+    server.sessions = calloc(server.session_count, sizeof *server.sessions);
+    if (server.sessions == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < server.session_count; i++) {                                   // Session n plays ROM n, round-robin when there are more sessions
+        session_t *session = &server.sessions[i];
+        session->rom = &corpus->roms[i % corpus->count];
+        session->chip8 = chip8_create_with_memory(session->rom->mode == MODE_XOCHIP ? CHIP8_XO_MEMORY_SIZE : CHIP8_MEMORY_SIZE);
+        if (session->chip8 == NULL || !chip8_corpus_load(session->chip8, session->rom)) {
+            exit(EXIT_FAILURE);
+        }
+        if (instructions_per_frame != 0) {
+            session->chip8->emulation_rate = instructions_per_frame * 60;
+        }
+        if (!chip8_take_snapshot(session->chip8)) {                                         // MESSAGE_RESET returns here
+            exit(EXIT_FAILURE);
+        }
+        printf("Session %u: %s (%s, %s quirks)\n", i, session->rom->name, chip8_mode_name(session->rom->mode), chip8_quirks_name(session->rom->quirks));
+    }
+    signal(SIGPIPE, SIG_IGN);                                                               // A viewer closing mid-send is an error return, not a signal
+    if ((server.listener = listen_on(port)) < 0) {
+        printf("Could not listen on port %u\n", port);
+        exit(EXIT_FAILURE);
+    }
+    printf("Serving on port %u, open http://localhost:%u/#N to watch session N\n", port, port);
+    fflush(stdout);
+    uint64_t due_at = now_ns();
+    uint64_t skipped = 0;
+    struct pollfd fds[MAX_CLIENTS + 1];
+    while (frame_limit == 0 || server.frames < frame_limit) {
+        const uint64_t now = now_ns();
+        fds[0] = (struct pollfd) {.fd = server.listener, .events = POLLIN};
+        for (uint32_t i = 0; i < server.client_count; i++) {
+            fds[i + 1] = (struct pollfd) {.fd = server.clients[i]->fd, .events = POLLIN | (server.clients[i]->output_length > 0 ? POLLOUT : 0)};
+        }
+        const uint32_t polled = server.client_count;
+        poll(fds, polled + 1, due_at > now ? (int)((due_at - now + 999999) / 1000000) : 0);    // Rounded up, so the loop wakes to a due frame instead of spinning
+        if (fds[0].revents & POLLIN) {
+            accept_clients(&server);
+        }
+        for (uint32_t i = polled; i-- > 0;) {                                               // Backwards, dropping moves the last client down. New ones past polled wait for the next poll
+            const bool alive = (fds[i + 1].revents & (POLLERR | POLLNVAL)) == 0
+                && ((fds[i + 1].revents & (POLLIN | POLLHUP)) == 0 || read_client(&server, server.clients[i]))
+                && (server.clients[i]->output_length == 0 || flush_output(server.clients[i]));
+            if (!alive) {
+                drop_client(&server, i);
+            }
+        }
+        uint32_t frames = 0;
+        while (now_ns() >= due_at && (frame_limit == 0 || server.frames < frame_limit)) {
+            if (++frames > MAX_CATCH_UP) {                                                   // Fell behind, drop the frames rather than racing to catch up
+                const uint64_t late = (now_ns() - due_at) / FRAME_NS + 1;
+                skipped += late;
+                due_at += late * FRAME_NS;
+                break;
+            }
+            run_frame(&server);
+            due_at += FRAME_NS;
+        }
+        for (uint32_t i = server.client_count; frames > 0 && i-- > 0;) {
+            if (server.clients[i]->output_length > 0 && !flush_output(server.clients[i])) {
+                drop_client(&server, i);
+            }
+        }
+    }
+    if (skipped > 0) {
+        printf("Skipped %llu frames in total\n", (unsigned long long)skipped);
+    }
+    while (server.client_count > 0) {
+        drop_client(&server, server.client_count - 1);
+    }
+    close(server.listener);
+    for (uint32_t i = 0; i < server.session_count; i++) {
+        chip8_destroy(server.sessions[i].chip8);
+    }
+    free(server.sessions);
+    chip8_corpus_destroy(corpus);
+    return EXIT_SUCCESS;
+}
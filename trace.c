@@ -0,0 +1,181 @@
+#define _POSIX_C_SOURCE 200809L                                                        // nanosleep
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+#include "align.h"
+
+// Little-endian trace file layout:
+//   "C8TR", u16 version, u16 reserved
+//   then per instruction u16 PC, u16 opcode, u32 mask, followed by the registers the mask names:
+//   one byte for each of V0-VF whose bit 0-15 is set, u16 I if bit 16 is set, and if bit 17 is set
+//   a u16 count of instructions dropped before this one. Registers are only written when they changed
+#define TRACE_VERSION 1
+#define TRACE_HEADER 8
+#define TRACE_I (1u << 16)
+#define TRACE_DROPPED (1u << 17)
+#define DRAIN_BATCH 4096        // Records written before the drain thread frees their slots
+
+// Store value as size little-endian bytes
+static uint8_t *put_le(uint8_t *out, uint32_t value, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        *out++ = value >> (8 * i);
+    }
+    return out;
+}
+
+// Read size little-endian bytes
+static uint32_t get_le(const uint8_t *in, size_t size) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= (uint32_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+// Write the ring out to the trace file until tracing stops and the ring is empty
+static void *drain_trace(void *arg) {
+    struct chip8_trace *trace = arg;
+    static _Thread_local uint8_t buffer[DRAIN_BATCH * 28];                                  // Largest record is 8 + 16 + 2 + 2 bytes
+    chip8_trace_record_t last = {0};
+    bool first = true;
+    bool failed = false;
+    uint64_t tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+    for (;;) {
+        const bool stopping = atomic_load_explicit(&trace->stop, memory_order_acquire);     // Read before head, so nothing appended before stop is missed
+        const uint64_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+        if (tail == head) {
+            if (stopping) {
+                break;
+            }
+            nanosleep(&(struct timespec) {.tv_nsec = 100000}, NULL);
+            continue;
+        }
+        uint8_t *out = buffer;
+        for (const uint64_t end = head - tail > DRAIN_BATCH ? tail + DRAIN_BATCH : head; tail != end; tail++) {
+            const chip8_trace_record_t *record = &trace->ring[tail & (CHIP8_TRACE_RECORDS - 1)];
+            uint8_t *fixed = out;
+            out += 8;
+            uint32_t mask = 0;
+            for (uint8_t half = 0; half < 16; half += 8) {
+                uint64_t now_half, last_half;
+                memcpy(&now_half, &record->V[half], 8);
+                memcpy(&last_half, &last.V[half], 8);
+                if (!first && now_half == last_half) {                                      // Most instructions change one register or none
+                    continue;
+                }
+                for (uint8_t i = half; i < half + 8; i++) {
+                    if (first || record->V[i] != last.V[i]) {
+                        mask |= 1u << i;
+                        *out++ = record->V[i];
+                    }
+                }
+            }
+            if (first || record->I != last.I) {
+                mask |= TRACE_I;
+                out = put_le(out, record->I, 2);
+            }
+            if (record->dropped != 0) {
+                mask |= TRACE_DROPPED;
+                out = put_le(out, record->dropped, 2);
+            }
+            put_le(put_le(put_le(fixed, record->PC, 2), record->opcode, 2), mask, 4);
+            last = *record;
+            first = false;
+        }
+        atomic_store_explicit(&trace->tail, tail, memory_order_release);                    // Slots are free once encoded, before the slow write
+        failed |= fwrite(buffer, out - buffer, 1, trace->file) != 1;
+    }
+    return failed ? trace : NULL;
+}
+
+// Start logging every instruction chip8 executes to path
+bool chip8_trace_start(chip8_t *chip8, const char path[]) {
+    if (chip8->trace != NULL) {
+        printf("Already tracing\n");
+        return false;
+    }
+    struct chip8_trace *trace = chip8_aligned_calloc(_Alignof(struct chip8_trace), sizeof *trace);
+    if (trace == NULL) {
+        return false;
+    }
+    trace->file = fopen(path, "wb");
+    if (trace->file == NULL) {
+        printf("Could not create trace: %s\n", path);
+        chip8_aligned_free(trace);
+        return false;
+    }
+    uint8_t header[TRACE_HEADER] = {'C', '8', 'T', 'R'};
+    put_le(&header[4], TRACE_VERSION, 2);
+    if (fwrite(header, sizeof header, 1, trace->file) != 1 || pthread_create(&trace->thread, NULL, drain_trace, trace) != 0) {
+        printf("Could not start trace: %s\n", path);
+        fclose(trace->file);
+        chip8_aligned_free(trace);
+        return false;
+    }
+    chip8->trace = trace;
+    return true;
+}
+
+// Write out what is left in the ring and stop tracing
+bool chip8_trace_stop(chip8_t *chip8) {
+    struct chip8_trace *trace = chip8->trace;
+    if (trace == NULL) {
+        return true;
+    }
+    chip8->trace = NULL;
+    atomic_store_explicit(&trace->stop, true, memory_order_release);
+    void *failed;
+    pthread_join(trace->thread, &failed);
+    const bool written = fclose(trace->file) == 0 && failed == NULL;
+    if (!written) {
+        printf("Could not write trace\n");
+    }
+    chip8_aligned_free(trace);
+    return written;
+}
+
+// Decode a trace file to one line of text per instruction
+bool chip8_trace_print(const char path[], FILE *out) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("Could not open trace: %s\n", path);
+        return false;
+    }
+    uint8_t header[TRACE_HEADER];
+    if (fread(header, sizeof header, 1, file) != 1 || memcmp(header, "C8TR", 4) != 0 || get_le(&header[4], 2) != TRACE_VERSION) {
+        printf("Not a trace of version %d: %s\n", TRACE_VERSION, path);
+        fclose(file);
+        return false;
+    }
+    uint8_t bytes[16 + 4];
+    uint8_t fixed[8];
+    while (fread(fixed, sizeof fixed, 1, file) == 1) {
+        const uint32_t mask = get_le(&fixed[4], 4);
+        size_t length = (mask & TRACE_I ? 2 : 0) + (mask & TRACE_DROPPED ? 2 : 0);
+        for (uint8_t i = 0; i < 16; i++) {
+            length += (mask >> i) & 1;
+        }
+        if (length > 0 && fread(bytes, length, 1, file) != 1) {
+            printf("Trace ends in the middle of a record: %s\n", path);
+            fclose(file);
+            return false;
+        }
+        const uint8_t *in = bytes;
+        if (mask & TRACE_DROPPED) {
+            fprintf(out, "... %u instructions dropped\n", get_le(&bytes[length - 2], 2));
+        }
+        fprintf(out, "%03X: %04X", get_le(fixed, 2), get_le(&fixed[2], 2));
+        for (uint8_t i = 0; i < 16; i++) {
+            if (mask & (1u << i)) {
+                fprintf(out, " V%X=%02X", i, *in++);
+            }
+        }
+        if (mask & TRACE_I) {
+            fprintf(out, " I=%03X", get_le(in, 2));
+        }
+        fputc('\n', out);
+    }
+    fclose(file);
+    return true;
+}
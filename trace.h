@@ -0,0 +1,68 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "chip8.h"
+
+// Records held between the interpreter and the thread writing them out, a power of two
+#define CHIP8_TRACE_RECORDS (1 << 18)
+
+// One executed instruction with the registers it left behind
+typedef struct {
+    uint16_t PC;            // Address the instruction was fetched from
+    uint16_t opcode;        // The instruction
+    uint16_t I;             // Index pointer after it ran
+    uint16_t dropped;       // Records lost to a full ring just before this one, saturating
+    uint8_t V[16];          // Registers after it ran
+} chip8_trace_record_t;
+
+// Single producer, single consumer ring of executed instructions. The interpreter appends without locking
+// and drops records while the ring is full, a background thread writes them to the trace file as deltas
+struct chip8_trace {
+    chip8_trace_record_t ring[CHIP8_TRACE_RECORDS];
+    _Alignas(64) _Atomic uint64_t head;     // Records appended, only written by the interpreter
+    uint64_t tail_seen;     // Value of tail the interpreter last read, so it only rereads when the ring looks full
+    uint32_t dropping;      // Records lost since the last one appended
+    uint64_t dropped;       // Records lost in total
+    _Alignas(64) _Atomic uint64_t tail;     // Records written out, only written by the drain thread
+    _Atomic bool stop;      // Set when tracing ends, the drain thread empties the ring and exits
+    FILE *file;             // Trace file, only used by the drain thread
+    pthread_t thread;       // Drain thread
+};
+
+// Append one instruction, called from the interpreter after it ran
+static inline void chip8_trace_record(struct chip8_trace *trace, uint16_t PC, uint16_t opcode, const chip8_t *chip8) {
+    const uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    if (head - trace->tail_seen == CHIP8_TRACE_RECORDS) {
+        trace->tail_seen = atomic_load_explicit(&trace->tail, memory_order_acquire);
+        if (head - trace->tail_seen == CHIP8_TRACE_RECORDS) {
+            trace->dropping++;
+            trace->dropped++;
+            return;
+        }
+    }
+    chip8_trace_record_t *record = &trace->ring[head & (CHIP8_TRACE_RECORDS - 1)];
+    record->PC = PC;
+    record->opcode = opcode;
+    record->I = chip8->I;
+    record->dropped = trace->dropping < 0xFFFF ? trace->dropping : 0xFFFF;
+    memcpy(record->V, chip8->V, sizeof record->V);
+    trace->dropping = 0;
+    atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+// Start logging every instruction chip8 executes to path. Tracing runs every engine through the cached loop
+bool chip8_trace_start(chip8_t *chip8, const char path[]);
+
+// Write out what is left in the ring, close the trace file and stop tracing. Returns false if the file could not be written
+bool chip8_trace_stop(chip8_t *chip8);
+
+// Decode a trace file to one line of text per instruction
+bool chip8_trace_print(const char path[], FILE *out);
+
+#endif
@@ -0,0 +1,12 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "trace.h"
+
+// Main
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        printf("Usage: %s trace\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    exit(chip8_trace_print(argv[1], stdout) ? EXIT_SUCCESS : EXIT_FAILURE);
+}